@@ -0,0 +1,779 @@
+
+/*
+ * bench - console hot paths of ct48fb against the simulated chip
+ *
+ * usage: bench [-x] [-n ops] [-c config] [-m mode] [-v]
+ *
+ * The driver is built right into this program on top of kshim and its
+ * sim register backend, so it runs on any Linux box. For every option
+ * set and mode a fresh process brings the driver up and times bmove,
+ * clear, putc/putcs, cursor moves, mode sets, palette loads, a program's
+ * mouse pointer and what gpm and scrollback make the console draw. Those
+ * two get fbcon's cursor timer as an interrupt in the middle of the
+ * driver, a down() it would block in aborts the run. Prints CSV:
+ *
+ *  config,mode,op,size,ops,ops_per_sec,bytes_per_sec,
+ *  reads_per_op,writes_per_op,vram_per_op,engine_cycles_per_op,
+ *  wait_us_per_op,host_ns_per_op
+ *
+ * Time is virtual: every register access, CPU access to VRAM and blit is
+ * charged by the model below, udelay() adds what the driver waits.
+ * ops_per_sec, bytes_per_sec and wait time come from that clock, reads
+ * and writes are register accesses, vram counts CPU accesses to video
+ * memory, engine cycles the ones the blitter makes. host_ns_per_op is
+ * what the driver code itself costs on the machine running the bench.
+ * The model is rough, compare numbers with each other, not with a real
+ * Toshiba.
+ *
+ * Blits really are drawn, by the engine model in blt.c, and only once
+ * the engine would be done with them. A register written while the
+ * engine is busy fails the run. With -x nothing is timed, instead every
+ * drawing op of the accelerated configs is done twice from the same
+ * random screen, through the driver and through the cfb code, and the
+ * results are compared:
+ *
+ *  config,mode,op,size,checked,mismatches
+ */
+
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/wait.h>
+
+#include "../module/ct48fb.c"
+#include "blt.h"
+
+/* cost model, a 65548 on VL bus */
+#define BENCH_IO_NS		300	/* VGA/XR/DR register access */
+#define BENCH_VRAM_NS		150	/* CPU access to VRAM, any width */
+#define BENCH_BLT_SETUP_NS	500	/* engine start */
+#define BENCH_CYCLE_NS		60	/* engine memory cycle */
+
+static struct blt bench_blt;
+static unsigned long long bench_busy_until;	/* engine is busy before that */
+static u_long bench_stream_cycles;		/* cost of the streamed blit */
+static u_long bench_collisions;			/* registers written while busy */
+static u_long bench_races;			/* VRAM touched while busy */
+
+static inline int bench_busy(void)
+{
+    return bench_blt.streaming || (kshim_clock_ns < bench_busy_until);
+}
+
+/* a blit is on screen once the engine is done with it */
+static void bench_retire(void)
+{
+    if (bench_blt.pending && !bench_busy())
+	blt_finish(&bench_blt);
+}
+
+/* the sim backend with the clock running */
+static u_char bench_r8(u_short port)
+{
+    u_char val;
+
+    kshim_clock_ns += BENCH_IO_NS;
+    val = ct48_sim_regs.r8(port);
+    kshim_irq_point();
+    return val;
+}
+static void bench_w8(u_short port, u_char val)
+{
+    kshim_clock_ns += BENCH_IO_NS;
+    ct48_sim_regs.w8(port, val);
+    kshim_irq_point();
+}
+static u_int bench_r32(u_short dr)
+{
+    u_int val;
+
+    kshim_clock_ns += BENCH_IO_NS;
+    bench_retire();
+    val = ct48_sim_regs.r32(dr);
+    if ((dr == DR04) && bench_busy())
+	val |= ctBitBLTBUSY;
+    kshim_irq_point();
+    return val;
+}
+static void bench_w32(u_short dr, u_int val)
+{
+    kshim_clock_ns += BENCH_IO_NS;
+    bench_retire();
+    if ((CT48_DR(dr) <= CT48_DR(DR07)) && bench_busy() && !bench_collisions++)
+	fprintf(stderr, "bench: DR%02d written while the engine is busy\n", CT48_DR(dr));
+    ct48_sim_regs.w32(dr, val);
+    kshim_irq_point();
+}
+
+static struct ct48fb_regops bench_regs = {
+    name:	"sim",
+    r8:		bench_r8,
+    w8:		bench_w8,
+    r32:	bench_r32,
+    w32:	bench_w32,
+};
+
+/* the CPU is about to touch VRAM */
+static void bench_vram(void)
+{
+    bench_retire();
+    if (bench_busy())
+	bench_races++;
+    kshim_irq_point();
+}
+
+/* DR07 written: busy for as many memory cycles as the engine makes */
+static void bench_blit(struct ct48fb_sim *s)
+{
+    u_long cycles;
+
+    if (!bench_blt.vram)
+	blt_init(&bench_blt, fb_info.fbmem_virt, fb_info.memsize);
+    cycles = blt_start(&bench_blt, &s->dr[CT48_DR(DR00)], ((s->xr[0x40] & 3) == 2) ? 2 : 1);
+    if (bench_blt.streaming) {
+	bench_stream_cycles = cycles;
+	bench_busy_until = 0;
+    } else {
+	bench_busy_until = kshim_clock_ns + BENCH_BLT_SETUP_NS + cycles * BENCH_CYCLE_NS;
+    }
+}
+
+/* CPU writes to VRAM are source data while the engine waits for them */
+static int bench_stream(volatile void *a, unsigned int v)
+{
+    if (!blt_feed(&bench_blt, v))
+	return 0;
+    if (!bench_blt.streaming)		/* last one, the engine draws the last line */
+	bench_busy_until = kshim_clock_ns + BENCH_BLT_SETUP_NS +
+	    bench_stream_cycles / ((bench_blt.dr[7] >> 16) & 0xfff) * BENCH_CYCLE_NS;
+    return 1;
+}
+
+static int bench_interrupt(void);
+
+/* what the 65548 in a Toshiba looks like: VL bus, 1 MB, linear at 12 MB */
+static void bench_chip(void)
+{
+    memset(&ct48_sim, 0, sizeof(ct48_sim));
+    ct48_sim.xr[0x00] = 0xdc;		/* 65548 */
+    ct48_sim.xr[0x01] = 0x07;		/* VL bus */
+    ct48_sim.xr[0x08] = 0x0c;
+    ct48_sim.xr[0x0f] = 0x02;		/* 1 MB */
+    ct48_sim.xr[0x51] = 0x03;		/* dual scan STN panel */
+    ct48_sim.xr[0x6f] = 0x02;		/* with frame acceleration */
+    ct48_sim.blit = bench_blit;
+    ct48fb_use_regs(&bench_regs);
+    kshim_vram_ns = BENCH_VRAM_NS;
+    kshim_vram_sync = bench_vram;
+    kshim_vram_stream = bench_stream;
+    kshim_interrupt = bench_interrupt;
+}
+
+/* ------------------- console --------------------------------------------- */
+
+#define FONTW	8
+#define FONTH	16
+
+static u_char bench_font[256 * FONTH];
+static struct vc_data bench_vc;
+static unsigned short bench_line[256];
+
+#define ATTR(fg, bg)	(((bg) << 12) | ((fg) << 8))
+
+/* what fbcon does with a console after the driver registered */
+static void bench_console(void)
+{
+    struct display *p = &fb_display[0];
+    int i;
+
+    for (i = 0; i < sizeof(bench_font); i++)
+	bench_font[i] = (i * 0x9d) ^ (i >> 4);
+    *p = disp;
+    p->fb_info = &fb_info.gen.info;
+    p->conp = &bench_vc;
+    p->fontdata = bench_font;
+    p->_fontwidth = FONTW;
+    p->_fontheight = FONTH;
+    p->charmask = 0xff;
+    p->fgshift = 8;
+    p->bgshift = 12;
+    bench_vc.vc_video_erase_char = ATTR(7, 0) | ' ';
+    if (p->dispsw->setup)
+	p->dispsw->setup(p);
+    if (p->dispsw->set_font)
+	p->dispsw->set_font(p, FONTW, FONTH);
+}
+
+/* console size follows the mode */
+static void bench_geometry(void)
+{
+    struct display *p = &fb_display[0];
+
+    bench_vc.vc_cols = p->var.xres / FONTW;
+    bench_vc.vc_rows = p->var.yres / FONTH;
+}
+
+static inline u_long cells(int w, int h)
+{
+    struct display *p = &fb_display[0];
+
+    return (u_long)w * h * FONTW * FONTH * (p->var.bits_per_pixel >> 3);
+}
+
+/* ------------------- interrupts ------------------------------------------ */
+
+#define BENCH_IRQ_NS	100000		/* cursor blinks while gpm and scrollback run */
+
+static int bench_irq_on;		/* the running op wants interrupts */
+static unsigned long long bench_irq_next;
+
+/*
+ * fbcon's cursor timer, in the middle of whatever the driver is doing:
+ * the cursor goes off and on again, so the screen ends up the same. The
+ * driver has to skip it while the engine is busy with the op.
+ */
+static int bench_interrupt(void)
+{
+    struct display *p = &fb_display[0];
+    int y = bench_vc.vc_rows - 1;
+
+    if (!bench_irq_on || (kshim_clock_ns < bench_irq_next))
+	return 0;
+    if (p->dispsw->cursor) {
+	p->dispsw->cursor(p, CM_ERASE, 0, y);
+	p->dispsw->cursor(p, CM_DRAW, 0, y);
+    } else {
+	p->dispsw->revc(p, 0, y);
+	p->dispsw->revc(p, 0, y);
+    }
+    bench_irq_next = kshim_clock_ns + BENCH_IRQ_NS;
+    return 1;
+}
+
+/* ------------------- operations ------------------------------------------ */
+
+/* w or h of 0 is the whole line or screen, returns bytes on screen changed */
+static u_long op_bmove(int n, int w, int h)
+{
+    struct display *p = &fb_display[0];
+    int cols = bench_vc.vc_cols, rows = bench_vc.vc_rows;
+    int x, y;
+
+    w = w ? w : cols;
+    h = h ? h : rows - 1;		/* a scroll */
+    x = n % (cols - w + 1);
+    y = n % (rows - h);
+    p->dispsw->bmove(p, y + 1, x, y, x, h, w);
+    return cells(w, h);
+}
+
+/* the other way round, down and to the right: the engine copies backwards */
+static u_long op_bmove_back(int n, int w, int h)
+{
+    struct display *p = &fb_display[0];
+    int cols = bench_vc.vc_cols, rows = bench_vc.vc_rows;
+    int x, y;
+
+    w = w ? w : cols - 1;
+    h = h ? h : rows - 1;
+    x = n % (cols - w);
+    y = n % (rows - h);
+    p->dispsw->bmove(p, y, x, y + 1, x + 1, h, w);
+    return cells(w, h);
+}
+
+static u_long op_clear(int n, int w, int h)
+{
+    struct display *p = &fb_display[0];
+    int cols = bench_vc.vc_cols, rows = bench_vc.vc_rows;
+    int x, y;
+
+    w = w ? w : cols;
+    h = h ? h : rows;
+    x = n % (cols - w + 1);
+    y = n % (rows - h + 1);
+    p->dispsw->clear(&bench_vc, p, y, x, h, w);
+    return cells(w, h);
+}
+
+static u_long op_putc(int n, int w, int h)
+{
+    struct display *p = &fb_display[0];
+
+    p->dispsw->putc(&bench_vc, p, ATTR(7, 0) | (n & 0xff), (n / bench_vc.vc_cols) % bench_vc.vc_rows,
+		    n % bench_vc.vc_cols);
+    return cells(1, 1);
+}
+
+/* h != 0: the colour changes every 8 characters */
+static u_long op_putcs(int n, int w, int h)
+{
+    struct display *p = &fb_display[0];
+    int i;
+
+    w = w ? w : bench_vc.vc_cols;
+    for (i = 0; i < w; i++)
+	bench_line[i] = (h ? ATTR(1 + (i >> 3) % 15, 0) : ATTR(7, 0)) | ((n + i) & 0xff);
+    p->dispsw->putcs(&bench_vc, p, bench_line, w, n % bench_vc.vc_rows, 0);
+    return cells(w, 1);
+}
+
+static u_long op_revc(int n, int w, int h)
+{
+    struct display *p = &fb_display[0];
+
+    p->dispsw->revc(p, n % bench_vc.vc_cols, (n / bench_vc.vc_cols) % bench_vc.vc_rows);
+    return cells(1, 1);
+}
+
+/* fbcon falls back to revc at the old and the new place without a cursor hook */
+static u_long op_cursor(int n, int w, int h)
+{
+    struct display *p = &fb_display[0];
+    static int ox, oy;
+    int x = n % bench_vc.vc_cols, y = (n / bench_vc.vc_cols) % bench_vc.vc_rows;
+
+    if (p->dispsw->cursor) {
+	p->dispsw->cursor(p, CM_MOVE, x, y);
+    } else {
+	p->dispsw->revc(p, ox, oy);
+	p->dispsw->revc(p, x, y);
+    }
+    ox = x;
+    oy = y;
+    return 0;
+}
+
+/* w != 0: switch between 640 and 800 wide, else set the same mode again */
+static u_long op_mode(int n, int w, int h)
+{
+    struct fb_var_screeninfo var = fb_display[0].var;
+
+    if (w) {
+	var.xres = var.xres_virtual = (var.xres == 640) ? 800 : 640;
+	var.yres = var.yres_virtual = (var.xres == 640) ? 480 : 600;
+	var.yoffset = 0;
+    }
+    var.activate = FB_ACTIVATE_NOW;
+    if (fbgen_set_var(&var, 0, &fb_info.gen.info))
+	printk(KERN_ERR "bench: mode set failed\n");
+    bench_geometry();
+    return 0;
+}
+
+/* console blanking and back, the chip is checked for a lost mode */
+static u_long op_blank(int n, int w, int h)
+{
+    ct48fb_blank(1, &fb_info.gen);
+    ct48fb_blank(0, &fb_info.gen);
+    return 0;
+}
+
+/* the text at x, y and what gpm makes of it */
+#define GPM_CELL(x, y)	(ATTR(7, 0) | (((x) + (y)) & 0xff))
+#define GPM_INV(c)	((c) ^ 0x7700)
+
+/*
+ * gpm with the cursor blinking: complement_pos() puts the cell under the
+ * old pointer back and inverts the one under the new with putc, w != 0
+ * also highlights a selection, invert_screen() redraws it with putcs
+ */
+static u_long op_gpm(int n, int w, int h)
+{
+    struct display *p = &fb_display[0];
+    int cols = bench_vc.vc_cols, rows = bench_vc.vc_rows;
+    int x = n * 3 % cols, y = n / 7 % rows, ox, oy, i;
+    u_long bytes = cells(1, 1);
+
+    bench_irq_on = 1;
+    if (n) {
+	ox = (n - 1) * 3 % cols;
+	oy = (n - 1) / 7 % rows;
+	p->dispsw->putc(&bench_vc, p, GPM_CELL(ox, oy), oy, ox);
+	bytes += cells(1, 1);
+    }
+    p->dispsw->putc(&bench_vc, p, GPM_INV(GPM_CELL(x, y)), y, x);
+    if (w) {
+	for (i = 0; i < cols / 2; i++)
+	    bench_line[i] = GPM_INV(GPM_CELL(i, y));
+	p->dispsw->putcs(&bench_vc, p, bench_line, cols / 2, y, 0);
+	bytes += cells(cols / 2, 1);
+    }
+    bench_irq_on = 0;
+    return bytes;
+}
+
+/*
+ * Shift-PgUp with the cursor blinking: fbcon redraws every line from its
+ * scrollback buffer with putcs, here a shell session with coloured prompts
+ */
+static u_long op_scrollback(int n, int w, int h)
+{
+    struct display *p = &fb_display[0];
+    int cols = bench_vc.vc_cols, rows = bench_vc.vc_rows;
+    int x, y;
+
+    bench_irq_on = 1;
+    for (y = 0; y < rows; y++) {
+	for (x = 0; x < cols; x++)
+	    bench_line[x] = ((x < 12) ? ATTR(2 + (n + y) % 3, 0) : ATTR(7, 0)) | ((n + x + y) & 0xff);
+	p->dispsw->putcs(&bench_vc, p, bench_line, cols, y, 0);
+    }
+    bench_irq_on = 0;
+    return cells(cols, rows);
+}
+
+/* what the driver said to an op's ioctl, a case it refuses isn't timed */
+static int bench_err;
+/* ...and the device it was opened as */
+static struct file bench_file = { 1, FMODE_READ | FMODE_WRITE };
+
+/* w entries of a palette fade, h != 0 queues them for the retrace and
+   has the timer find one every 4th update */
+static u_long op_cmap(int n, int w, int h)
+{
+    static u16 ramp[3][256];
+    struct fb_cmap cmap;
+    int i;
+
+    for (i = 0; i < w; i++)
+	ramp[0][i] = ramp[1][i] = ramp[2][i] = ((n + i) & 0xff) * 0x101;
+    memset(&cmap, 0, sizeof(cmap));
+    cmap.start = 16;
+    cmap.len = w;
+    cmap.red = ramp[0];
+    cmap.green = ramp[1];
+    cmap.blue = ramp[2];
+    if (h) {
+	bench_err = ct48fb_ioctl(NULL, NULL, CT48FB_PUTCMAP_VBL, (u_long)&cmap, 0, &fb_info.gen.info);
+	if ((n & 3) == 3)
+	    ct48fb_cmap_timer((unsigned long)&fb_info);
+    } else
+	bench_err = fbgen_set_cmap(&cmap, 1, 0, &fb_info.gen.info);
+    return 0;
+}
+
+/* a program's mouse pointer: w != 0 changes its shape, else moves it */
+static u_long op_pointer(int n, int w, int h)
+{
+    static struct ct48_cursor cur;
+    int i;
+
+    memset(&cur, 0, sizeof(cur));
+    cur.set = CT48_CUR_POS | CT48_CUR_SHOW;
+    cur.enable = 1;
+    cur.x = n % bench_vc.vc_cols * 8 - 4;
+    cur.y = n % bench_vc.vc_rows * 16 - 4;
+    if (w || !n) {
+	cur.set |= CT48_CUR_IMAGE | CT48_CUR_HOT | CT48_CUR_COLOR;
+	cur.hot_x = cur.hot_y = n & 7;
+	cur.fg = 0xffffff;
+	for (i = 0; i < CT48_CURSOR_BYTES; i++) {
+	    cur.mask[i] = (i & 3) < 2 ? 0xff : 0;
+	    cur.image[i] = 0xaa >> (n & 1);
+	}
+    }
+    bench_err = ct48fb_ioctl(NULL, &bench_file, CT48FB_CURSOR, (u_long)&cur, 0, &fb_info.gen.info);
+    return 0;
+}
+
+static const struct {
+    const char *op, *size;
+    u_long (*run)(int n, int w, int h);
+    int w, h;
+    int div;				/* that many times fewer ops */
+} cases[] = {
+    { "bmove",	"1x1",		op_bmove,	1, 1,	1 },
+    { "bmove",	"8x1",		op_bmove,	8, 1,	1 },
+    { "bmove",	"line",		op_bmove,	0, 1,	1 },
+    { "bmove",	"screen",	op_bmove,	0, 0,	20 },
+    { "clear",	"1x1",		op_clear,	1, 1,	1 },
+    { "clear",	"8x1",		op_clear,	8, 1,	1 },
+    { "clear",	"line",		op_clear,	0, 1,	1 },
+    { "clear",	"screen",	op_clear,	0, 0,	20 },
+    { "putc",	"1",		op_putc,	1, 1,	1 },
+    { "putcs",	"8",		op_putcs,	8, 0,	1 },
+    { "putcs",	"line",		op_putcs,	0, 0,	1 },
+    { "putcs",	"line-attr",	op_putcs,	0, 1,	1 },
+    { "cursor",	"move",		op_cursor,	0, 0,	1 },
+    { "mode",	"same",		op_mode,	0, 0,	20 },
+    { "mode",	"switch",	op_mode,	1, 0,	20 },
+    { "blank",	"unblank",	op_blank,	0, 0,	20 },
+    { "gpm",	"pointer",	op_gpm,		0, 0,	1 },
+    { "gpm",	"select",	op_gpm,		1, 0,	1 },
+    { "scrollback", "screen",	op_scrollback,	0, 0,	20 },
+    { "cmap",	"64",		op_cmap,	64, 0,	1 },
+    { "cmap",	"64-vbl",	op_cmap,	64, 1,	1 },
+    { "pointer",	"move",		op_pointer,	0, 0,	1 },
+    { "pointer",	"shape",	op_pointer,	1, 0,	1 },
+    { NULL }
+};
+
+/* option sets, '+' separated (the CSV has commas) */
+static const char *configs[] = {
+    "noaccel",
+    "accputc+hwcursor",
+    "accputc+nohwcursor",
+    "noaccputc+hwcursor",
+    "noaccputc+nohwcursor",
+    NULL
+};
+
+static const char *modes[] = {
+    "640x480x8", "640x480x16", "800x600x8", "800x600x16",
+    "640x400x8", "512x384x16",		/* computed, not from the tables */
+    NULL
+};
+
+/* ------------------- measuring ------------------------------------------- */
+
+static unsigned long long host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* everything queued has to be on screen before the clock stops */
+static void bench_sync(void)
+{
+    ct48fb_own_get(CT48_OWN_DRIVER);
+    ct48fb_blt_sync();
+    ct48fb_own_put();
+}
+
+static void bench_case(const char *config, const char *mode, int i, int ops)
+{
+    unsigned long long clk, delay, host;
+    u_long reads, writes, vram, bytes;
+    unsigned long long cycles;
+    double secs;
+    int n;
+
+    bench_sync();
+    clk = kshim_clock_ns;
+    delay = kshim_delay_ns;
+    reads = ct48_sim.reads;
+    writes = ct48_sim.writes;
+    vram = kshim_vram;
+    cycles = bench_blt.cycles;
+    bytes = 0;
+    bench_err = 0;
+    host = host_ns();
+
+    for (n = 0; (n < ops) && !bench_err; n++) {
+	bytes += cases[i].run(n, cases[i].w, cases[i].h);
+	kshim_run_timers();
+    }
+    bench_sync();
+
+    if (bench_err) {
+	/* -ENODEV: not with these options */
+	if (bench_err != -ENODEV)
+	    fprintf(stderr, "bench: %s %s %s %s: error %d, skipped\n",
+		    config, mode, cases[i].op, cases[i].size, bench_err);
+	return;
+    }
+    host = host_ns() - host;
+    secs = (kshim_clock_ns - clk) / 1e9;
+    printf("%s,%s,%s,%s,%d,", config, mode, cases[i].op, cases[i].size, ops);
+    if (secs > 0)
+	printf("%.0f,%.0f,", ops / secs, bytes / secs);
+    else
+	printf(",,");			/* no simulated time, no rate */
+    printf("%.1f,%.1f,%.1f,%.1f,%.2f,%.0f\n",
+	   (double)(ct48_sim.reads - reads) / ops,
+	   (double)(ct48_sim.writes - writes) / ops,
+	   (double)(kshim_vram - vram) / ops,
+	   (double)(bench_blt.cycles - cycles) / ops,
+	   (kshim_delay_ns - delay) / 1000.0 / ops,
+	   (double)host / ops);
+}
+
+/* ------------------- cross-check ----------------------------------------- */
+
+/* the drawing ops, cursor moves are revc without a cursor hook */
+static const struct {
+    const char *op, *size;
+    u_long (*run)(int n, int w, int h);
+    int w, h;
+    int div;				/* that many times fewer ops */
+} checks[] = {
+    { "bmove",	"1x1",		op_bmove,	1, 1,	1 },
+    { "bmove",	"8x1",		op_bmove,	8, 1,	1 },
+    { "bmove",	"line",		op_bmove,	0, 1,	1 },
+    { "bmove",	"screen",	op_bmove,	0, 0,	10 },
+    { "bmove-back", "1x1",	op_bmove_back,	1, 1,	1 },
+    { "bmove-back", "8x1",	op_bmove_back,	8, 1,	1 },
+    { "bmove-back", "screen",	op_bmove_back,	0, 0,	10 },
+    { "clear",	"1x1",		op_clear,	1, 1,	1 },
+    { "clear",	"8x1",		op_clear,	8, 1,	1 },
+    { "clear",	"line",		op_clear,	0, 1,	1 },
+    { "clear",	"screen",	op_clear,	0, 0,	10 },
+    { "putc",	"1",		op_putc,	1, 1,	1 },
+    { "putcs",	"8",		op_putcs,	8, 0,	1 },
+    { "putcs",	"line",		op_putcs,	0, 0,	1 },
+    { "putcs",	"line-attr",	op_putcs,	0, 1,	1 },
+    { "revc",	"1",		op_revc,	1, 1,	1 },
+    { "gpm",	"pointer",	op_gpm,		0, 0,	1 },
+    { "gpm",	"select",	op_gpm,		1, 0,	1 },
+    { "scrollback", "screen",	op_scrollback,	0, 0,	10 },
+    { NULL }
+};
+
+/*
+ * Run op i through the driver on the screen and through cfb on a copy of
+ * it, the copy starts over from the screen after a mismatch.
+ */
+static int check_case(const char *config, const char *mode, int i, int ops)
+{
+    struct display *p = &fb_display[0];
+    struct display_switch *acc = p->dispsw;
+    struct display_switch *cfb = (p->var.bits_per_pixel == 8) ? &fbcon_cfb8 : &fbcon_cfb16;
+    u_char *screen = p->screen_base, *shadow;
+    u_long size = p->var.yres * p->line_length, off;
+    int n, bad = 0;
+
+    shadow = malloc(size);
+    if (!shadow) {
+	fprintf(stderr, "bench: out of memory\n");
+	exit(1);
+    }
+    bench_sync();
+    for (off = 0; off < size; off++)
+	screen[off] = rand();
+    memcpy(shadow, screen, size);
+
+    for (n = 0; n < ops; n++) {
+	checks[i].run(n, checks[i].w, checks[i].h);
+	bench_sync();
+
+	p->dispsw = cfb;
+	p->screen_base = shadow;
+	checks[i].run(n, checks[i].w, checks[i].h);
+	p->dispsw = acc;
+	p->screen_base = screen;
+
+	if (!memcmp(screen, shadow, size))
+	    continue;
+	if (!bad++) {
+	    for (off = 0; screen[off] == shadow[off]; off++)
+		;
+	    fprintf(stderr, "bench: %s %s %s %s op %d: x %lu y %lu is 0x%02x, cfb has 0x%02x\n",
+		    config, mode, checks[i].op, checks[i].size, n,
+		    off % p->line_length / (p->var.bits_per_pixel >> 3), off / p->line_length,
+		    screen[off], shadow[off]);
+	}
+	memcpy(shadow, screen, size);
+    }
+    printf("%s,%s,%s,%s,%d,%d\n", config, mode, checks[i].op, checks[i].size, ops, bad);
+    free(shadow);
+    return bad;
+}
+
+/* one driver instance, in its own process so every run starts clean */
+static int bench_run(const char *config, const char *mode, int ops, int check)
+{
+    char options[128], *s;
+    int i, bad = 0;
+
+    snprintf(options, sizeof(options), "%s,mode:%s", config, mode);
+    for (s = options; *s; s++)
+	if (*s == '+')
+	    *s = ',';
+
+    bench_chip();
+    ct48fb_setup(options);
+    if (ct48fb_init()) {
+	fprintf(stderr, "bench: driver didn't come up with %s\n", options);
+	return 1;
+    }
+    bench_console();
+    bench_geometry();
+
+    if (check) {
+	for (i = 0; checks[i].op; i++)
+	    bad += check_case(config, mode, i, (ops / checks[i].div) ? (ops / checks[i].div) : 1);
+    } else {
+	for (i = 0; cases[i].op; i++)
+	    bench_case(config, mode, i, (ops / cases[i].div) ? (ops / cases[i].div) : 1);
+    }
+    fflush(stdout);
+    if (bench_races)
+	fprintf(stderr, "bench: %s %s: VRAM touched %lu times while the engine was busy\n",
+		config, mode, bench_races);
+    if (bench_collisions)
+	fprintf(stderr, "bench: %s %s: engine registers written %lu times while it was busy\n",
+		config, mode, bench_collisions);
+    return bad || bench_collisions;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: bench [-x] [-n ops] [-c config] [-m mode] [-v]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *onlyconfig = NULL, *onlymode = NULL;
+    int c, i, j, ops = 0, check = 0, status, err = 0;
+    pid_t pid;
+
+    while ((c = getopt(argc, argv, "xn:c:m:v")) != -1) {
+	switch (c) {
+	    case 'x':
+		check = 1;
+		break;
+	    case 'n':
+		ops = atoi(optarg);
+		if (ops <= 0)
+		    usage();
+		break;
+	    case 'c':
+		onlyconfig = optarg;
+		break;
+	    case 'm':
+		onlymode = optarg;
+		break;
+	    case 'v':
+		kshim_verbose = 1;
+		break;
+	    default:
+		usage();
+	}
+    }
+    if (!ops)
+	ops = check ? 200 : 2000;
+
+    if (check)
+	printf("config,mode,op,size,checked,mismatches\n");
+    else
+	printf("config,mode,op,size,ops,ops_per_sec,bytes_per_sec,"
+	       "reads_per_op,writes_per_op,vram_per_op,engine_cycles_per_op,"
+	       "wait_us_per_op,host_ns_per_op\n");
+    for (i = 0; configs[i]; i++) {
+	if (onlyconfig && strcmp(onlyconfig, configs[i]))
+	    continue;
+	if (check && !strcmp(configs[i], "noaccel"))
+	    continue;			/* that is cfb already */
+	for (j = 0; modes[j]; j++) {
+	    if (onlymode && strcmp(onlymode, modes[j]))
+		continue;
+	    fflush(stdout);
+	    pid = fork();
+	    if (pid < 0) {
+		perror("bench: fork");
+		return 1;
+	    }
+	    if (!pid)
+		exit(bench_run(configs[i], modes[j], ops, check));
+	    if ((waitpid(pid, &status, 0) < 0) || !WIFEXITED(status) || WEXITSTATUS(status)) {
+		fprintf(stderr, "bench: %s %s failed\n", configs[i], modes[j]);
+		err = 1;
+	    }
+	}
+    }
+    return err;
+}
@@ -0,0 +1,175 @@
+
+/*
+ * blt.c - reference model of the 6554x BitBLT engine, see blt.h
+ */
+
+#include <string.h>
+#include "blt.h"
+
+#define LINES(e)	(((e)->dr[7] >> 16) & 0xfff)
+#define BYTES(e)	((e)->dr[7] & 0xfff)
+#define SPITCH(e)	((e)->dr[0] & 0xfff)
+#define DPITCH(e)	(((e)->dr[0] >> 16) & 0xfff)
+
+/* which operands the ROP byte looks at */
+#define USES_D(rop)	((((rop) >> 1) ^ (rop)) & 0x55)
+#define USES_S(rop)	((((rop) >> 2) ^ (rop)) & 0x33)
+#define USES_P(rop)	((((rop) >> 4) ^ (rop)) & 0x0f)
+
+void blt_init(struct blt *e, unsigned char *vram, unsigned long size)
+{
+    memset(e, 0, sizeof(*e));
+    e->vram = vram;
+    e->size = size;
+}
+
+static inline unsigned char *at(struct blt *e, unsigned long addr)
+{
+    return e->vram + (addr & (e->size - 1));
+}
+
+/* 32-bit accesses needed for n bytes from a */
+static inline unsigned long span(unsigned long a, unsigned long n)
+{
+    return n ? ((a + n - 1) >> 2) - (a >> 2) + 1 : 0;
+}
+
+/* bit i of the ROP is the result for pattern, source, destination = i2 i1 i0 */
+#define MUX(sel, one, zero)	(((sel) & (one)) | (~(sel) & (zero)))
+#define ROPBIT(rop, i)		(((rop) & (1 << (i))) ? 0xff : 0)
+
+static inline unsigned char rop3(unsigned int rop, unsigned char p, unsigned char s, unsigned char d)
+{
+    return MUX(p, MUX(s, MUX(d, ROPBIT(rop, 7), ROPBIT(rop, 6)), MUX(d, ROPBIT(rop, 5), ROPBIT(rop, 4))),
+		  MUX(s, MUX(d, ROPBIT(rop, 3), ROPBIT(rop, 2)), MUX(d, ROPBIT(rop, 1), ROPBIT(rop, 0))));
+}
+
+/* line y of the command, sys is its source data when the CPU streams it */
+static void blt_line(struct blt *e, int y, const unsigned char *sys)
+{
+    unsigned int ctl = e->dr[4], rop = ctl & BLT_ROP;
+    int bytes = BYTES(e), bpp = e->bpp;
+    int l2r = (ctl & BLT_LEFT2RIGHT) != 0;
+    long dy = (ctl & BLT_TOP2BOTTOM) ? y : -y;
+    unsigned long d = e->dr[6] + dy * DPITCH(e);
+    unsigned long s = e->dr[5] + dy * SPITCH(e);
+    unsigned long dleft = l2r ? d : d - (bytes - 1);
+    unsigned char pat = *at(e, e->dr[1] + ((BLT_PATSEED(ctl) + dy) & 7));
+    unsigned char p = 0, sv = 0, dv = 0;
+    unsigned int col;
+    int i, pos, pix, k, x, bit;
+
+    for (i = 0; i < bytes; i++) {
+	pos = l2r ? i : bytes - 1 - i;		/* from the left end */
+	pix = pos / bpp;
+	k = pos % bpp;
+
+	if (USES_S(rop)) {
+	    if (ctl & BLT_SRCMONO) {
+		bit = (sys ? sys[pix >> 3] : *at(e, s + (pix >> 3))) & (0x80 >> (pix & 7));
+		if (!bit && (ctl & BLT_BGTRANSPARENT))
+		    continue;
+		col = bit ? e->dr[3] : e->dr[2];
+		sv = col >> (8 * k);
+	    } else {
+		sv = sys ? sys[pos] : *at(e, l2r ? s + i : s - i);
+	    }
+	}
+	if (USES_P(rop)) {
+	    if (ctl & BLT_PATSOLID) {
+		p = e->dr[3] >> (8 * k);
+	    } else if (ctl & BLT_PATMONO) {
+		/* pattern is aligned to the screen, not to the blit */
+		x = ((dleft + pos) % (DPITCH(e) ? DPITCH(e) : 1)) / bpp;
+		bit = pat & (0x80 >> (x & 7));
+		if (!bit && (ctl & BLT_BGTRANSPARENT) && !(ctl & BLT_SRCMONO))
+		    continue;
+		col = bit ? e->dr[3] : e->dr[2];
+		p = col >> (8 * k);
+	    } else {
+		x = ((dleft + pos) % (DPITCH(e) ? DPITCH(e) : 1)) / bpp;
+		p = *at(e, e->dr[1] + (((BLT_PATSEED(ctl) + dy) & 7) * 8 + (x & 7)) * bpp + k);
+	    }
+	}
+	if (USES_D(rop))
+	    dv = *at(e, dleft + pos);
+	*at(e, dleft + pos) = rop3(rop, p, sv, dv);
+    }
+}
+
+unsigned long blt_start(struct blt *e, const unsigned int *dr, int bpp)
+{
+    unsigned int ctl, rop;
+    unsigned long cycles = 0, left, src;
+    int y, lines, bytes;
+    long dy;
+
+    memcpy(e->dr, dr, sizeof(e->dr));
+    e->bpp = bpp;
+    e->line = 0;
+    e->have = 0;
+    ctl = e->dr[4];
+    rop = ctl & BLT_ROP;
+    lines = LINES(e);
+    bytes = BYTES(e);
+    if (!lines || !bytes)
+	return 0;
+
+    for (y = 0; y < lines; y++) {
+	dy = (ctl & BLT_TOP2BOTTOM) ? y : -y;
+	left = e->dr[6] + dy * DPITCH(e);
+	if (!(ctl & BLT_LEFT2RIGHT))
+	    left -= bytes - 1;
+	cycles += span(left, bytes) * (USES_D(rop) ? 2 : 1);
+	if (USES_S(rop) && !(ctl & BLT_SRCSYSTEM)) {
+	    src = e->dr[5] + dy * SPITCH(e);
+	    if (ctl & BLT_SRCMONO)
+		cycles += span(src, (bytes / bpp + 7) / 8);
+	    else
+		cycles += span((ctl & BLT_LEFT2RIGHT) ? src : src - (bytes - 1), bytes);
+	}
+    }
+    if (USES_P(rop) && !(ctl & BLT_PATSOLID))
+	cycles += (ctl & BLT_PATMONO) ? 2 : span(e->dr[1], 64 * bpp);
+    e->cycles += cycles;
+
+    if (USES_S(rop) && (ctl & BLT_SRCSYSTEM)) {
+	/* every line starts a new dword */
+	if (ctl & BLT_SRCMONO)
+	    e->linedw = ((bytes / bpp + 7) / 8 + 3) / 4;
+	else
+	    e->linedw = (bytes + 3) / 4;
+	e->streaming = 1;
+    } else {
+	e->pending = 1;
+    }
+    return cycles;
+}
+
+void blt_finish(struct blt *e)
+{
+    int y;
+
+    if (!e->pending)
+	return;
+    for (y = 0; y < LINES(e); y++)
+	blt_line(e, y, NULL);
+    e->pending = 0;
+    e->blits++;
+}
+
+int blt_feed(struct blt *e, unsigned int data)
+{
+    if (!e->streaming)
+	return 0;
+    e->stream[e->have++] = data;
+    if (e->have == e->linedw) {
+	blt_line(e, e->line++, (unsigned char *)e->stream);
+	e->have = 0;
+	if (e->line == LINES(e)) {
+	    e->streaming = 0;
+	    e->blits++;
+	}
+    }
+    return 1;
+}
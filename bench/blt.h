@@ -0,0 +1,57 @@
+
+/*
+ * blt.h - reference model of the 6554x BitBLT engine
+ *
+ * Works on a VRAM array the way the chip does with the DR00-DR07 values
+ * the driver programs: source and destination pitch, the ROP byte over
+ * pattern, source and destination, both directions on both axes, mono
+ * source and pattern expansion to DR02/DR03 with background transparency,
+ * solid pattern and source streamed by the CPU. Bytes are processed one by
+ * one in blit order, so a wrongly chosen direction smears overlapping
+ * copies just like the chip would.
+ *
+ * Memory cycles are counted as 32-bit accesses the engine makes to VRAM.
+ */
+
+#ifndef _BLT_H
+#define _BLT_H
+
+/* DR04 */
+#define BLT_ROP			0x000ff
+#define BLT_TOP2BOTTOM		0x00100
+#define BLT_LEFT2RIGHT		0x00200
+#define BLT_SRCMONO		0x00800
+#define BLT_PATMONO		0x01000
+#define BLT_BGTRANSPARENT	0x02000
+#define BLT_SRCSYSTEM		0x04000
+#define BLT_PATSEED(x)		(((x) >> 16) & 7)
+#define BLT_PATSOLID		0x80000
+#define BLT_BUSY		0x100000
+
+#define BLT_STREAM_MAX		1024	/* dwords of one system source line */
+
+struct blt {
+    unsigned char *vram;
+    unsigned long size;			/* power of 2, addresses wrap */
+
+    unsigned int dr[8];			/* DR00-DR07 of the command */
+    int bpp;				/* bytes per pixel */
+    int pending;			/* latched, blt_finish() runs it */
+    int streaming;			/* waiting for system source data */
+    int line;				/* next line to draw */
+    unsigned int linedw, have;		/* dwords per source line, got so far */
+    unsigned int stream[BLT_STREAM_MAX];
+
+    unsigned long blits;
+    unsigned long long cycles;		/* engine memory cycles */
+};
+
+void blt_init(struct blt *e, unsigned char *vram, unsigned long size);
+/* DR07 was written: returns the memory cycles the command is going to take */
+unsigned long blt_start(struct blt *e, const unsigned int *dr, int bpp);
+/* draw a latched command that doesn't wait for the CPU */
+void blt_finish(struct blt *e);
+/* a dword of system source, 0 if the engine isn't waiting for one */
+int blt_feed(struct blt *e, unsigned int data);
+
+#endif
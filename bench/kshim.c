@@ -0,0 +1,620 @@
+
+/*
+ * kshim.c - runtime side of the userspace kernel environment, see kshim.h
+ */
+
+#include <stdarg.h>
+#include "kshim.h"
+
+unsigned long long kshim_clock_ns;
+unsigned long long kshim_delay_ns;
+unsigned long kshim_vram;
+unsigned int kshim_vram_ns;
+int kshim_verbose;
+
+unsigned long jiffies;
+
+int kshim_irq;					/* in_interrupt() */
+int kshim_irqoff;				/* spin_lock_irqsave() nesting */
+int (*kshim_interrupt)(void);
+
+static struct task_struct kshim_task = { 1 };
+struct task_struct *kshim_current = &kshim_task;
+
+#define MAX_NR_CONSOLES	1
+struct display fb_display[MAX_NR_CONSOLES];
+
+int kshim_printk(const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    /* errors always, the rest only when asked for */
+    if (!kshim_verbose && strncmp(fmt, KERN_ERR, 3))
+	return 0;
+    if ((fmt[0] == '<') && fmt[1] && (fmt[2] == '>'))
+	fmt += 3;
+    va_start(ap, fmt);
+    n = vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+/* ------------------- time ------------------------------------------------ */
+
+static void kshim_tick(void)
+{
+    jiffies = kshim_clock_ns / (1000000000ULL / HZ);
+}
+
+void udelay(unsigned long us)
+{
+    kshim_clock_ns += us * 1000ULL;
+    kshim_delay_ns += us * 1000ULL;
+    kshim_tick();
+    kshim_irq_point();
+}
+
+void mdelay(unsigned long ms)
+{
+    udelay(ms * 1000);
+}
+
+signed long schedule_timeout(signed long t)
+{
+    udelay(t * (1000000 / HZ));
+    return 0;
+}
+
+int kshim_signal_pending(void)
+{
+    return 0;
+}
+
+#define KSHIM_TIMERS	8
+
+static struct timer_list *kshim_timers[KSHIM_TIMERS];
+
+void add_timer(struct timer_list *t)
+{
+    int i;
+
+    for (i = 0; i < KSHIM_TIMERS; i++) {
+	if (!kshim_timers[i] || (kshim_timers[i] == t)) {
+	    kshim_timers[i] = t;
+	    t->pending = 1;
+	    return;
+	}
+    }
+    fprintf(stderr, "kshim: out of timers\n");
+    abort();
+}
+
+int mod_timer(struct timer_list *t, unsigned long expires)
+{
+    int was = t->pending;
+
+    t->expires = expires;
+    add_timer(t);
+    return was;
+}
+
+int del_timer(struct timer_list *t)
+{
+    int i, was = t->pending;
+
+    for (i = 0; i < KSHIM_TIMERS; i++)
+	if (kshim_timers[i] == t)
+	    kshim_timers[i] = NULL;
+    t->pending = 0;
+    return was;
+}
+
+#define KSHIM_TASKS	4
+
+static struct tq_struct *kshim_tasks[KSHIM_TASKS];
+
+int schedule_task(struct tq_struct *t)
+{
+    int i;
+
+    if (t->pending)
+	return 0;
+    for (i = 0; i < KSHIM_TASKS; i++)
+	if (!kshim_tasks[i]) {
+	    kshim_tasks[i] = t;
+	    t->pending = 1;
+	    return 1;
+	}
+    fprintf(stderr, "kshim: too many tasks\n");
+    abort();
+}
+
+void flush_scheduled_tasks(void)
+{
+    struct tq_struct *t;
+    int i;
+
+    for (i = 0; i < KSHIM_TASKS; i++) {
+	t = kshim_tasks[i];
+	if (t) {
+	    kshim_tasks[i] = NULL;
+	    t->pending = 0;
+	    t->routine(t->data);
+	}
+    }
+}
+
+/* timers run in interrupt context, as from the timer interrupt */
+static void kshim_timer_irq(void)
+{
+    struct timer_list *t;
+    int i;
+
+    kshim_tick();
+    kshim_irq++;
+    for (i = 0; i < KSHIM_TIMERS; i++) {
+	t = kshim_timers[i];
+	if (t && t->pending && !time_before(jiffies, t->expires)) {
+	    del_timer(t);
+	    t->function(t->data);
+	}
+    }
+    kshim_irq--;
+}
+
+/* the harness calls this between operations, keventd gets to run too */
+void kshim_run_timers(void)
+{
+    kshim_timer_irq();
+    flush_scheduled_tasks();
+}
+
+/*
+ * Somewhere an interrupt could come in: in udelay() and, from the
+ * harness, at register and VRAM accesses. Not with interrupts off and not
+ * nested; the harness' handler says whether one was due, expired timers
+ * run on its way out.
+ */
+void kshim_irq_point(void)
+{
+    int fired;
+
+    if (!kshim_interrupt || kshim_irq || kshim_irqoff)
+	return;
+    kshim_irq++;
+    fired = kshim_interrupt();
+    kshim_irq--;
+    if (fired)
+	kshim_timer_irq();
+}
+
+/* the one process never has to wait, if it would it's waiting for itself */
+void down(struct semaphore *s)
+{
+    if (s->count <= 0) {
+	fprintf(stderr, "kshim: down() on a semaphore already held\n");
+	abort();
+    }
+    s->count--;
+}
+
+/* ------------------- I/O ------------------------------------------------- */
+
+/* the driver runs on the sim backend, real ports are a bug here */
+static void kshim_noport(unsigned short port)
+{
+    fprintf(stderr, "kshim: port I/O to 0x%x outside the register backend\n", port);
+    abort();
+}
+
+unsigned char inb(unsigned short port) { kshim_noport(port); return 0; }
+unsigned short inw(unsigned short port) { kshim_noport(port); return 0; }
+unsigned int inl(unsigned short port) { kshim_noport(port); return 0; }
+void outb(unsigned char v, unsigned short port) { kshim_noport(port); }
+void outw(unsigned short v, unsigned short port) { kshim_noport(port); }
+void outl(unsigned int v, unsigned short port) { kshim_noport(port); }
+
+void (*kshim_vram_sync)(void);
+int (*kshim_vram_stream)(volatile void *a, unsigned int v);
+
+static inline void kshim_vram_access(void)
+{
+    kshim_vram++;
+    kshim_clock_ns += kshim_vram_ns;
+    if (kshim_vram_sync)
+	kshim_vram_sync();
+}
+
+/* a write the blitter takes as source data doesn't reach memory */
+static inline int kshim_vram_streamed(volatile void *a, unsigned int v)
+{
+    if (!kshim_vram_stream || !kshim_vram_stream(a, v))
+	return 0;
+    kshim_vram++;
+    kshim_clock_ns += kshim_vram_ns;
+    return 1;
+}
+
+unsigned char readb(const volatile void *a)
+{
+    kshim_vram_access();
+    return *(const volatile u8 *)a;
+}
+unsigned short readw(const volatile void *a)
+{
+    kshim_vram_access();
+    return *(const volatile u16 *)a;
+}
+unsigned int readl(const volatile void *a)
+{
+    kshim_vram_access();
+    return *(const volatile u32 *)a;
+}
+void writeb(unsigned char v, volatile void *a)
+{
+    if (kshim_vram_streamed(a, v))
+	return;
+    kshim_vram_access();
+    *(volatile u8 *)a = v;
+}
+void writew(unsigned short v, volatile void *a)
+{
+    if (kshim_vram_streamed(a, v))
+	return;
+    kshim_vram_access();
+    *(volatile u16 *)a = v;
+}
+void writel(unsigned int v, volatile void *a)
+{
+    if (kshim_vram_streamed(a, v))
+	return;
+    kshim_vram_access();
+    *(volatile u32 *)a = v;
+}
+
+/* a dword at a time, reads and writes */
+void fb_memmove(void *d, const void *s, size_t n)
+{
+    kshim_vram += 2 * ((n + 3) / 4);
+    kshim_clock_ns += 2ULL * ((n + 3) / 4) * kshim_vram_ns;
+    if (kshim_vram_sync)
+	kshim_vram_sync();
+    memmove(d, s, n);
+}
+
+/* the harness maps its VRAM buffer at the one linear base there is */
+static void *kshim_vram_buf;
+
+void *ioremap(unsigned long off, unsigned long size)
+{
+    free(kshim_vram_buf);
+    kshim_vram_buf = calloc(1, size);
+    return kshim_vram_buf;
+}
+
+void iounmap(void *a)
+{
+    if (a == kshim_vram_buf)
+	kshim_vram_buf = NULL;
+    free(a);
+}
+
+int check_region(unsigned long s, unsigned long n) { return 0; }
+void *request_region(unsigned long s, unsigned long n, const char *name) { return (void *)1; }
+void release_region(unsigned long s, unsigned long n) { }
+void *request_mem_region(unsigned long s, unsigned long n, const char *name) { return (void *)1; }
+void release_mem_region(unsigned long s, unsigned long n) { }
+
+struct proc_dir_entry *create_proc_read_entry(const char *name, int mode, struct proc_dir_entry *base,
+					      read_proc_t *read_proc, void *data)
+{
+    return NULL;
+}
+void remove_proc_entry(const char *name, struct proc_dir_entry *parent) { }
+
+int pci_enable_device(struct pci_dev *dev) { return 0; }
+int pci_module_init(struct pci_driver *drv) { return -ENODEV; }
+void pci_unregister_driver(struct pci_driver *drv) { }
+
+/* ------------------- fbmem ----------------------------------------------- */
+
+int register_framebuffer(struct fb_info *fb_info) { return 0; }
+int unregister_framebuffer(struct fb_info *fb_info) { return 0; }
+
+static u16 red16[] = {
+    0x0000, 0x0000, 0x0000, 0x0000, 0xaaaa, 0xaaaa, 0xaaaa, 0xaaaa,
+    0x5555, 0x5555, 0x5555, 0x5555, 0xffff, 0xffff, 0xffff, 0xffff
+};
+static u16 green16[] = {
+    0x0000, 0x0000, 0xaaaa, 0xaaaa, 0x0000, 0x0000, 0x5555, 0xaaaa,
+    0x5555, 0x5555, 0xffff, 0xffff, 0x5555, 0x5555, 0xffff, 0xffff
+};
+static u16 blue16[] = {
+    0x0000, 0xaaaa, 0x0000, 0xaaaa, 0x0000, 0xaaaa, 0x0000, 0xaaaa,
+    0x5555, 0xffff, 0x5555, 0xffff, 0x5555, 0xffff, 0x5555, 0xffff
+};
+static struct fb_cmap default_16_colors = { 0, 16, red16, green16, blue16, NULL };
+
+struct fb_cmap *fb_default_cmap(int len)
+{
+    return &default_16_colors;
+}
+
+int fb_alloc_cmap(struct fb_cmap *cmap, int len, int transp)
+{
+    int size = len * sizeof(u16);
+
+    if (cmap->len != len) {
+	free(cmap->red);
+	free(cmap->green);
+	free(cmap->blue);
+	free(cmap->transp);
+	cmap->red = cmap->green = cmap->blue = cmap->transp = NULL;
+	cmap->len = 0;
+	if (!len)
+	    return 0;
+	cmap->red = malloc(size);
+	cmap->green = malloc(size);
+	cmap->blue = malloc(size);
+	if (transp)
+	    cmap->transp = malloc(size);
+	if (!cmap->red || !cmap->green || !cmap->blue || (transp && !cmap->transp))
+	    return -ENOMEM;
+    }
+    cmap->start = 0;
+    cmap->len = len;
+    fb_copy_cmap(fb_default_cmap(len), cmap, 0);
+    return 0;
+}
+
+void fb_copy_cmap(struct fb_cmap *from, struct fb_cmap *to, int fsfromto)
+{
+    int size, tooff = 0, fromoff = 0;
+
+    if (to->start > from->start)
+	fromoff = to->start - from->start;
+    else
+	tooff = from->start - to->start;
+    size = to->len - tooff;
+    if (size > (int)(from->len - fromoff))
+	size = from->len - fromoff;
+    if (size <= 0)
+	return;
+    size *= sizeof(u16);
+    memcpy(to->red + tooff, from->red + fromoff, size);
+    memcpy(to->green + tooff, from->green + fromoff, size);
+    memcpy(to->blue + tooff, from->blue + fromoff, size);
+    if (from->transp && to->transp)
+	memcpy(to->transp + tooff, from->transp + fromoff, size);
+}
+
+int fb_get_cmap(struct fb_cmap *cmap, int kspc,
+		int (*getcolreg)(u_int, u_int *, u_int *, u_int *, u_int *, struct fb_info *),
+		struct fb_info *info)
+{
+    u_int i, r, g, b, t;
+
+    for (i = 0; i < cmap->len; i++) {
+	if (getcolreg(cmap->start + i, &r, &g, &b, &t, info))
+	    break;
+	cmap->red[i] = r;
+	cmap->green[i] = g;
+	cmap->blue[i] = b;
+	if (cmap->transp)
+	    cmap->transp[i] = t;
+    }
+    return 0;
+}
+
+int fb_set_cmap(struct fb_cmap *cmap, int kspc,
+		int (*setcolreg)(u_int, u_int, u_int, u_int, u_int, struct fb_info *),
+		struct fb_info *info)
+{
+    u_int i;
+
+    for (i = 0; i < cmap->len; i++)
+	if (setcolreg(cmap->start + i, cmap->red[i], cmap->green[i], cmap->blue[i],
+		      cmap->transp ? cmap->transp[i] : 0, info))
+	    break;
+    return 0;
+}
+
+/* ------------------- cfb8/cfb16 stand-ins -------------------------------- */
+
+/*
+ * What the console draws with when acceleration is off. Not the kernel's
+ * code, but the same kind of traffic: dword writes for glyphs and fills,
+ * moves a line at a time, read-modify-write for the cursor.
+ */
+
+struct display_switch fbcon_dummy;
+
+static inline int cfb_bpp(struct display *p)
+{
+    return p->var.bits_per_pixel >> 3;
+}
+
+static inline u8 *cfb_addr(struct display *p, int x, int y)
+{
+    return (u8 *)p->screen_base + y * p->line_length + x * cfb_bpp(p);
+}
+
+static u32 cfb_pixel(struct display *p, int col)
+{
+    if (cfb_bpp(p) == 1)
+	return col;
+    return ((u16 *)p->dispsw_data)[col];
+}
+
+static void cfb_fill(struct display *p, int x, int y, int w, int h, u32 pixel)
+{
+    u32 fill = (cfb_bpp(p) == 1) ? pixel * 0x01010101 : pixel * 0x00010001;
+    int bytes = w * cfb_bpp(p);
+    u8 *dest;
+    int i;
+
+    for (; h > 0; h--, y++) {
+	dest = cfb_addr(p, x, y);
+	for (i = 0; i + 4 <= bytes; i += 4)
+	    fb_writel(fill, dest + i);
+	for (; i < bytes; i++)
+	    fb_writeb(fill, dest + i);
+    }
+}
+
+static void cfb_bmove(struct display *p, int sy, int sx, int dy, int dx, int height, int width)
+{
+    int fw = fontwidth(p), fh = fontheight(p);
+    int bytes = width * fw * cfb_bpp(p);
+    int i, step = 1;
+
+    sy *= fh;
+    dy *= fh;
+    height *= fh;
+    if (sy < dy) {
+	sy += height - 1;
+	dy += height - 1;
+	step = -1;
+    }
+    for (i = 0; i < height; i++, sy += step, dy += step)
+	fb_memmove(cfb_addr(p, dx * fw, dy), cfb_addr(p, sx * fw, sy), bytes);
+}
+
+static void cfb_clear(struct vc_data *conp, struct display *p, int sy, int sx, int height, int width)
+{
+    cfb_fill(p, sx * fontwidth(p), sy * fontheight(p), width * fontwidth(p), height * fontheight(p),
+	     cfb_pixel(p, attr_bgcol_ec(p, conp)));
+}
+
+static void cfb_putc(struct vc_data *conp, struct display *p, int c, int yy, int xx)
+{
+    int fw = fontwidth(p), fh = fontheight(p), bpp = cfb_bpp(p);
+    int step = (fw <= 8) ? 1 : 2;
+    u8 *cdat = p->fontdata + (c & p->charmask) * fh * step;
+    u32 fg = cfb_pixel(p, attr_fgcol(p, c)), bg = cfb_pixel(p, attr_bgcol(p, c));
+    u32 data, bits;
+    u8 *dest;
+    int row, x, n;
+
+    for (row = 0; row < fh; row++, cdat += step) {
+	dest = cfb_addr(p, xx * fw, yy * fh + row);
+	bits = (step == 1) ? (cdat[0] << 8) : ((cdat[0] << 8) | cdat[1]);
+	data = 0;
+	n = 0;
+	for (x = 0; x < fw; x++) {
+	    data |= ((bits & (0x8000 >> x)) ? fg : bg) << (8 * bpp * n);
+	    if (++n * bpp == 4) {
+		fb_writel(data, dest);
+		dest += 4;
+		data = 0;
+		n = 0;
+	    }
+	}
+    }
+}
+
+static void cfb_putcs(struct vc_data *conp, struct display *p, const unsigned short *s, int count, int yy, int xx)
+{
+    while (count-- > 0)
+	cfb_putc(conp, p, scr_readw(s++), yy, xx++);
+}
+
+static void cfb_revc(struct display *p, int xx, int yy)
+{
+    u32 mask = (cfb_bpp(p) == 1) ? 0x0f0f0f0f : 0xffffffff;
+    int bytes = fontwidth(p) * cfb_bpp(p);
+    u8 *dest;
+    int row, i;
+
+    for (row = 0; row < fontheight(p); row++) {
+	dest = cfb_addr(p, xx * fontwidth(p), yy * fontheight(p) + row);
+	for (i = 0; i < bytes; i += 4)
+	    fb_writel(fb_readl(dest + i) ^ mask, dest + i);
+    }
+}
+
+static void cfb_clear_margins(struct vc_data *conp, struct display *p, int bottom_only)
+{
+    int right = conp->vc_cols * fontwidth(p), bottom = conp->vc_rows * fontheight(p);
+    u32 bg = cfb_pixel(p, attr_bgcol_ec(p, conp));
+
+    if (!bottom_only && (right < p->var.xres))
+	cfb_fill(p, right, p->var.yoffset, p->var.xres - right, p->var.yres, bg);
+    if (bottom < p->var.yres)
+	cfb_fill(p, 0, p->var.yoffset + bottom, right, p->var.yres - bottom, bg);
+}
+
+void fbcon_cfb8_setup(struct display *p) { }
+void fbcon_cfb8_bmove(struct display *p, int sy, int sx, int dy, int dx, int height, int width)
+{
+    cfb_bmove(p, sy, sx, dy, dx, height, width);
+}
+void fbcon_cfb8_clear(struct vc_data *conp, struct display *p, int sy, int sx, int height, int width)
+{
+    cfb_clear(conp, p, sy, sx, height, width);
+}
+void fbcon_cfb8_putc(struct vc_data *conp, struct display *p, int c, int yy, int xx)
+{
+    cfb_putc(conp, p, c, yy, xx);
+}
+void fbcon_cfb8_putcs(struct vc_data *conp, struct display *p, const unsigned short *s, int count, int yy, int xx)
+{
+    cfb_putcs(conp, p, s, count, yy, xx);
+}
+void fbcon_cfb8_revc(struct display *p, int xx, int yy)
+{
+    cfb_revc(p, xx, yy);
+}
+void fbcon_cfb8_clear_margins(struct vc_data *conp, struct display *p, int bottom_only)
+{
+    cfb_clear_margins(conp, p, bottom_only);
+}
+
+struct display_switch fbcon_cfb8 = {
+    setup:		fbcon_cfb8_setup,
+    bmove:		fbcon_cfb8_bmove,
+    clear:		fbcon_cfb8_clear,
+    putc:		fbcon_cfb8_putc,
+    putcs:		fbcon_cfb8_putcs,
+    revc:		fbcon_cfb8_revc,
+    clear_margins:	fbcon_cfb8_clear_margins,
+    fontwidthmask:	FONTWIDTH(4)|FONTWIDTH(8)|FONTWIDTH(12)|FONTWIDTH(16)
+};
+
+void fbcon_cfb16_setup(struct display *p) { }
+void fbcon_cfb16_bmove(struct display *p, int sy, int sx, int dy, int dx, int height, int width)
+{
+    cfb_bmove(p, sy, sx, dy, dx, height, width);
+}
+void fbcon_cfb16_clear(struct vc_data *conp, struct display *p, int sy, int sx, int height, int width)
+{
+    cfb_clear(conp, p, sy, sx, height, width);
+}
+void fbcon_cfb16_putc(struct vc_data *conp, struct display *p, int c, int yy, int xx)
+{
+    cfb_putc(conp, p, c, yy, xx);
+}
+void fbcon_cfb16_putcs(struct vc_data *conp, struct display *p, const unsigned short *s, int count, int yy, int xx)
+{
+    cfb_putcs(conp, p, s, count, yy, xx);
+}
+void fbcon_cfb16_revc(struct display *p, int xx, int yy)
+{
+    cfb_revc(p, xx, yy);
+}
+void fbcon_cfb16_clear_margins(struct vc_data *conp, struct display *p, int bottom_only)
+{
+    cfb_clear_margins(conp, p, bottom_only);
+}
+
+struct display_switch fbcon_cfb16 = {
+    setup:		fbcon_cfb16_setup,
+    bmove:		fbcon_cfb16_bmove,
+    clear:		fbcon_cfb16_clear,
+    putc:		fbcon_cfb16_putc,
+    putcs:		fbcon_cfb16_putcs,
+    revc:		fbcon_cfb16_revc,
+    clear_margins:	fbcon_cfb16_clear_margins,
+    fontwidthmask:	FONTWIDTH(4)|FONTWIDTH(8)|FONTWIDTH(12)|FONTWIDTH(16)
+};
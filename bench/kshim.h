@@ -0,0 +1,378 @@
+
+/*
+ * kshim.h - just enough of a 2.4 kernel to build ct48fb.c in userspace
+ *
+ * Every kernel header the driver includes is a one-line stub generated by
+ * the Makefile that pulls this in. Runtime parts live in kshim.c: time is
+ * virtual and only moves in udelay() and through the costs the harness
+ * charges, VRAM is a plain buffer and cfb8/cfb16 are simple stand-ins
+ * with the same kind of VRAM traffic.
+ */
+
+#ifndef _KSHIM_H
+#define _KSHIM_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#define ERESTARTSYS 512			/* kernel internal, not in the C library's */
+#include <sys/types.h>
+
+typedef uint8_t u8; typedef uint16_t u16; typedef uint32_t u32; typedef int32_t s32;
+typedef uint8_t __u8; typedef uint16_t __u16; typedef uint32_t __u32; typedef int16_t __s16; typedef int32_t __s32;
+typedef char *caddr_t;
+typedef unsigned short kdev_t;
+#define __LITTLE_ENDIAN 1234
+
+#define __init
+#define __exit
+#define __initdata
+#define __devinit
+#define __devexit
+#define __devinitdata
+#define THIS_MODULE NULL
+#define MODULE_LICENSE(x)
+#define MODULE_SUPPORTED_DEVICE(x)
+#define MODULE_AUTHOR(x)
+#define MODULE_DESCRIPTION(x)
+#define MODULE_PARM(a,b)
+#define MODULE_PARM_DESC(a,b)
+#define MODULE_DEVICE_TABLE(a,b)
+#define EXPORT_SYMBOL(x)
+#define KERN_ERR "<3>"
+#define KERN_WARNING "<4>"
+#define KERN_INFO "<6>"
+#define KERN_DEBUG "<7>"
+#define printk(...) kshim_printk(__VA_ARGS__)
+int kshim_printk(const char *fmt, ...);
+#define HZ 100
+extern unsigned long jiffies;
+#define time_after(a,b) ((long)(b) - (long)(a) < 0)
+#define time_before(a,b) time_after(b,a)
+
+void udelay(unsigned long us);
+void mdelay(unsigned long ms);
+#define NODEV 0
+#define GET_FB_IDX(node) 0
+#define MINOR(x) (x)
+
+/* port and memory i/o, provided by the harness */
+unsigned char inb(unsigned short port);
+unsigned short inw(unsigned short port);
+unsigned int inl(unsigned short port);
+void outb(unsigned char v, unsigned short port);
+void outw(unsigned short v, unsigned short port);
+void outl(unsigned int v, unsigned short port);
+unsigned char readb(const volatile void *a);
+unsigned short readw(const volatile void *a);
+unsigned int readl(const volatile void *a);
+void writeb(unsigned char v, volatile void *a);
+void writew(unsigned short v, volatile void *a);
+void writel(unsigned int v, volatile void *a);
+#define fb_readb readb
+#define fb_readw readw
+#define fb_readl readl
+#define fb_writeb writeb
+#define fb_writew writew
+#define fb_writel writel
+void fb_memmove(void *d, const void *s, size_t n);
+#define fb_memset memset
+void *ioremap(unsigned long off, unsigned long size);
+void iounmap(void *a);
+int check_region(unsigned long s, unsigned long n);
+void *request_region(unsigned long s, unsigned long n, const char *name);
+void release_region(unsigned long s, unsigned long n);
+void *request_mem_region(unsigned long s, unsigned long n, const char *name);
+void release_mem_region(unsigned long s, unsigned long n);
+#define mb() do { } while (0)
+#define wmb() do { } while (0)
+#define rmb() do { } while (0)
+#define barrier() do { } while (0)
+#define likely(x) (x)
+#define unlikely(x) (x)
+
+/* spinlocks, timers, wait queues; the harness raises interrupts, see kshim_irq_point() */
+extern int kshim_irq, kshim_irqoff;
+typedef struct { int l; } spinlock_t;
+#define SPIN_LOCK_UNLOCKED (spinlock_t){0}
+#define spin_lock_init(x) ((x)->l = 0)
+#define spin_lock(x) ((void)(x))
+#define spin_unlock(x) ((void)(x))
+#define spin_lock_irqsave(x,f) ((void)(x), (f) = 0, kshim_irqoff++)
+#define spin_unlock_irqrestore(x,f) ((void)(x), (void)(f), kshim_irqoff--)
+#define spin_trylock(x) 1
+#define in_interrupt() (kshim_irq != 0)
+struct timer_list { unsigned long expires; unsigned long data; void (*function)(unsigned long); int pending; };
+static inline void init_timer(struct timer_list *t) { t->pending = 0; }
+void add_timer(struct timer_list *t);
+int mod_timer(struct timer_list *t, unsigned long expires);
+int del_timer(struct timer_list *t);
+#define del_timer_sync del_timer
+static inline int timer_pending(struct timer_list *t) { return t->pending; }
+typedef struct { int dummy; } wait_queue_head_t;
+#define DECLARE_WAIT_QUEUE_HEAD(x) wait_queue_head_t x
+#define init_waitqueue_head(x) do { } while (0)
+#define wake_up(x) do { } while (0)
+#define wake_up_interruptible(x) do { } while (0)
+#define TASK_INTERRUPTIBLE 1
+#define TASK_RUNNING 0
+#define set_current_state(x) do { } while (0)
+signed long schedule_timeout(signed long t);
+int kshim_signal_pending(void);
+#define signal_pending(x) kshim_signal_pending()
+struct task_struct { int pid; long need_resched; };
+extern struct task_struct *kshim_current;
+#define current kshim_current
+#define schedule() do { } while (0)
+
+/* semaphores: nothing runs concurrently, blocking would be a deadlock */
+struct semaphore { int count; };
+#define init_MUTEX(s) ((s)->count = 1)
+void down(struct semaphore *s);
+#define down_trylock(s) ((s)->count > 0 ? ((s)->count--, 0) : 1)
+#define up(s) ((s)->count++)
+
+/* keventd, tasks run from kshim_run_timers() */
+struct tq_struct { void (*routine)(void *); void *data; int pending; };
+#define INIT_TQUEUE(t, f, d) ((t)->routine = (f), (t)->data = (d), (t)->pending = 0)
+int schedule_task(struct tq_struct *t);
+void flush_scheduled_tasks(void);
+
+/* open files, f_count is 0 by the time ->release runs */
+struct file { int f_count; unsigned int f_mode; };
+#define FMODE_READ 1
+#define FMODE_WRITE 2
+#define file_count(f) ((f)->f_count)
+
+/* memory */
+#define GFP_KERNEL 0
+#define kmalloc(s,f) malloc(s)
+#define kfree(p) free(p)
+#define vmalloc(s) malloc(s)
+#define vfree(p) free(p)
+
+/* user access */
+#define VERIFY_READ 0
+#define VERIFY_WRITE 1
+#define verify_area(t,p,s) 0
+#define copy_from_user(d,s,n) (memcpy((d),(s),(n)), 0)
+#define copy_to_user(d,s,n) (memcpy((d),(s),(n)), 0)
+#define get_user(x,p) ((x) = *(p), 0)
+#define put_user(x,p) (*(p) = (x), 0)
+
+/* proc */
+struct proc_dir_entry { int dummy; };
+typedef int (read_proc_t)(char *page, char **start, off_t off, int count, int *eof, void *data);
+struct proc_dir_entry *create_proc_read_entry(const char *name, int mode, struct proc_dir_entry *base, read_proc_t *read_proc, void *data);
+void remove_proc_entry(const char *name, struct proc_dir_entry *parent);
+
+/* ioctl encoding */
+#ifndef _IOC
+#include <sys/ioctl.h>
+#endif
+
+/* pci */
+struct pci_dev { unsigned long resource_start[6]; };
+struct pci_device_id { unsigned int vendor, device, subvendor, subdevice, class, class_mask; unsigned long driver_data; };
+struct pci_driver { const char *name; const struct pci_device_id *id_table; int (*probe)(struct pci_dev *, const struct pci_device_id *); void (*remove)(struct pci_dev *); };
+#define PCI_VENDOR_ID_CT 0x102c
+#define PCI_DEVICE_ID_CT_65548 0x00dc
+#define PCI_ANY_ID (~0)
+int pci_enable_device(struct pci_dev *dev);
+#define pci_resource_start(dev, bar) ((dev)->resource_start[(bar)])
+int pci_module_init(struct pci_driver *drv);
+void pci_unregister_driver(struct pci_driver *drv);
+
+char *strsep(char **s, const char *ct);
+#define simple_strtoul(cp, endp, base) strtoul(cp, endp, base)
+
+/* console */
+struct vc_data {
+    unsigned int vc_num;
+    unsigned int vc_cols, vc_rows;
+    unsigned short vc_video_erase_char;
+    unsigned short vc_hi_font_mask;
+};
+#define CM_DRAW 1
+#define CM_ERASE 2
+#define CM_MOVE 3
+
+/* fb.h */
+#define FB_TYPE_PACKED_PIXELS 0
+#define FB_VISUAL_MONO01 0
+#define FB_VISUAL_TRUECOLOR 2
+#define FB_VISUAL_PSEUDOCOLOR 3
+#define FB_VISUAL_DIRECTCOLOR 4
+#define FB_ACCEL_NONE 0
+#define FB_ACCEL_CT_6555x 16
+#define FB_ACTIVATE_NOW 0
+#define FB_ACTIVATE_NXTOPEN 1
+#define FB_ACTIVATE_TEST 2
+#define FB_ACTIVATE_MASK 15
+#define FB_ACTIVATE_VBL 16
+#define FB_ACTIVATE_ALL 64
+#define FB_ACCELF_TEXT 1
+#define FB_VMODE_NONINTERLACED 0
+#define FB_VMODE_YWRAP 256
+#define FB_VMODE_SMOOTH_XPAN 512
+#define FBINFO_FLAG_DEFAULT 0
+#define FB_VBLANK_VBLANKING 0x001
+#define FB_VBLANK_HBLANKING 0x002
+#define FB_VBLANK_HAVE_VBLANK 0x004
+#define FB_VBLANK_HAVE_HBLANK 0x008
+#define FB_VBLANK_HAVE_COUNT 0x010
+#define FB_VBLANK_HAVE_VCOUNT 0x020
+#define FB_VBLANK_HAVE_HCOUNT 0x040
+#define FB_VBLANK_VSYNCING 0x080
+#define FB_VBLANK_HAVE_VSYNC 0x100
+#define FBIOGET_VBLANK _IOR('F', 0x12, struct fb_vblank)
+#define FB_SYNC_HOR_HIGH_ACT 1
+#define FB_SYNC_VERT_HIGH_ACT 2
+
+struct fb_bitfield { __u32 offset, length, msb_right; };
+struct fb_fix_screeninfo {
+    char id[16]; unsigned long smem_start; __u32 smem_len; __u32 type; __u32 type_aux; __u32 visual;
+    __u16 xpanstep, ypanstep, ywrapstep; __u32 line_length; unsigned long mmio_start; __u32 mmio_len; __u32 accel; __u16 reserved[3];
+};
+struct fb_var_screeninfo {
+    __u32 xres, yres, xres_virtual, yres_virtual, xoffset, yoffset, bits_per_pixel, grayscale;
+    struct fb_bitfield red, green, blue, transp;
+    __u32 nonstd, activate, height, width, accel_flags;
+    __u32 pixclock, left_margin, right_margin, upper_margin, lower_margin, hsync_len, vsync_len, sync, vmode;
+    __u32 reserved[6];
+};
+struct fb_cmap { __u32 start, len; __u16 *red, *green, *blue, *transp; };
+struct fb_vblank { __u32 flags, count, vcount, hcount; __u32 reserved[4]; };
+
+struct fb_info;
+struct inode; struct file; struct vm_area_struct;
+struct fb_ops {
+    void *owner;
+    int (*fb_open)(struct fb_info *info, int user);
+    int (*fb_release)(struct fb_info *info, int user);
+    int (*fb_get_fix)(struct fb_fix_screeninfo *fix, int con, struct fb_info *info);
+    int (*fb_get_var)(struct fb_var_screeninfo *var, int con, struct fb_info *info);
+    int (*fb_set_var)(struct fb_var_screeninfo *var, int con, struct fb_info *info);
+    int (*fb_get_cmap)(struct fb_cmap *cmap, int kspc, int con, struct fb_info *info);
+    int (*fb_set_cmap)(struct fb_cmap *cmap, int kspc, int con, struct fb_info *info);
+    int (*fb_pan_display)(struct fb_var_screeninfo *var, int con, struct fb_info *info);
+    int (*fb_ioctl)(struct inode *inode, struct file *file, unsigned int cmd, unsigned long arg, int con, struct fb_info *info);
+    int (*fb_mmap)(struct fb_info *info, struct file *file, struct vm_area_struct *vma);
+    int (*fb_rasterimg)(struct fb_info *info, int start);
+};
+struct display;
+struct fb_info {
+    char modename[40]; kdev_t node; int flags; int open;
+    struct fb_var_screeninfo var; struct fb_fix_screeninfo fix; struct fb_cmap cmap;
+    struct fb_ops *fbops; char *screen_base; struct display *disp; struct vc_data *display_fg;
+    char fontname[40];
+    int (*changevar)(int);
+    int (*switch_con)(int, struct fb_info *);
+    int (*updatevar)(int, struct fb_info *);
+    void (*blank)(int, struct fb_info *);
+    void *pseudo_palette; void *par;
+};
+struct fb_info_gen;
+struct fbgen_hwswitch {
+    void (*detect)(void);
+    int (*encode_fix)(struct fb_fix_screeninfo *fix, const void *par, struct fb_info_gen *info);
+    int (*decode_var)(const struct fb_var_screeninfo *var, void *par, struct fb_info_gen *info);
+    int (*encode_var)(struct fb_var_screeninfo *var, const void *par, struct fb_info_gen *info);
+    void (*get_par)(void *par, struct fb_info_gen *info);
+    void (*set_par)(const void *par, struct fb_info_gen *info);
+    int (*getcolreg)(unsigned regno, unsigned *red, unsigned *green, unsigned *blue, unsigned *transp, struct fb_info *info);
+    int (*setcolreg)(unsigned regno, unsigned red, unsigned green, unsigned blue, unsigned transp, struct fb_info *info);
+    int (*pan_display)(const struct fb_var_screeninfo *var, struct fb_info_gen *info);
+    int (*blank)(int blank_mode, struct fb_info_gen *info);
+    void (*set_disp)(const void *par, struct display *disp, struct fb_info_gen *info);
+};
+struct fb_info_gen { struct fb_info info; int parsize; struct fbgen_hwswitch *fbhw; };
+
+int register_framebuffer(struct fb_info *fb_info);
+int unregister_framebuffer(struct fb_info *fb_info);
+int fb_alloc_cmap(struct fb_cmap *cmap, int len, int transp);
+void fb_copy_cmap(struct fb_cmap *from, struct fb_cmap *to, int fsfromto);
+int fb_get_cmap(struct fb_cmap *cmap, int kspc, int (*getcolreg)(u_int, u_int *, u_int *, u_int *, u_int *, struct fb_info *), struct fb_info *fb_info);
+int fb_set_cmap(struct fb_cmap *cmap, int kspc, int (*setcolreg)(u_int, u_int, u_int, u_int, u_int, struct fb_info *), struct fb_info *fb_info);
+struct fb_cmap *fb_default_cmap(int len);
+
+int fbgen_get_fix(struct fb_fix_screeninfo *fix, int con, struct fb_info *info);
+int fbgen_get_var(struct fb_var_screeninfo *var, int con, struct fb_info *info);
+int fbgen_set_var(struct fb_var_screeninfo *var, int con, struct fb_info *info);
+int fbgen_get_cmap(struct fb_cmap *cmap, int kspc, int con, struct fb_info *info);
+int fbgen_set_cmap(struct fb_cmap *cmap, int kspc, int con, struct fb_info *info);
+int fbgen_pan_display(struct fb_var_screeninfo *var, int con, struct fb_info *info);
+int fbgen_do_set_var(struct fb_var_screeninfo *var, int isactive, struct fb_info_gen *info);
+void fbgen_set_disp(int con, struct fb_info_gen *info);
+void fbgen_install_cmap(int con, struct fb_info_gen *info);
+int fbgen_update_var(int con, struct fb_info *info);
+int fbgen_switch(int con, struct fb_info *info);
+void fbgen_blank(int blank, struct fb_info *info);
+
+/* fbcon.h */
+struct display_switch {
+    void (*setup)(struct display *p);
+    void (*bmove)(struct display *p, int sy, int sx, int dy, int dx, int height, int width);
+    void (*clear)(struct vc_data *conp, struct display *p, int sy, int sx, int height, int width);
+    void (*putc)(struct vc_data *conp, struct display *p, int c, int yy, int xx);
+    void (*putcs)(struct vc_data *conp, struct display *p, const unsigned short *s, int count, int yy, int xx);
+    void (*revc)(struct display *p, int xx, int yy);
+    void (*cursor)(struct display *p, int mode, int xx, int yy);
+    int (*set_font)(struct display *p, int width, int height);
+    void (*clear_margins)(struct vc_data *conp, struct display *p, int bottom_only);
+    unsigned int fontwidthmask;
+};
+#define FONTWIDTH(w) (1 << ((w)-1))
+#define SCROLL_YREDRAW 3
+struct display {
+    struct fb_var_screeninfo var; struct fb_cmap cmap; char *screen_base;
+    int visual, type, type_aux; u_short ypanstep, ywrapstep; u_long line_length;
+    u_short can_soft_blank, inverse;
+    struct display_switch *dispsw; void *dispsw_data;
+    struct fb_info *fb_info;
+    u_short scrollmode; short yscroll; int vrows;
+    struct vc_data *conp;
+    unsigned char *fontdata; unsigned short _fontheightlog, _fontwidthlog, _fontheight, _fontwidth;
+    int userfont; u_short charmask; u_short fgshift, bgshift;
+    u_short cursor_x, cursor_y; int fgcol, bgcol;
+};
+#define fontheight(p) ((p)->_fontheight)
+#define fontwidth(p) ((p)->_fontwidth)
+#define attr_fgcol(p,s) (((s) >> ((p)->fgshift)) & 0x0f)
+#define attr_bgcol(p,s) (((s) >> ((p)->bgshift)) & 0x0f)
+#define attr_bgcol_ec(p,conp) ((conp) ? (((conp)->vc_video_erase_char >> ((p)->bgshift)) & 0x0f) : 0)
+#define scr_readw(a) (*(a))
+extern struct display fb_display[];
+extern struct display_switch fbcon_dummy;
+#define FBCON_HAS_CFB8
+#define FBCON_HAS_CFB16
+extern struct display_switch fbcon_cfb8, fbcon_cfb16;
+void fbcon_cfb8_setup(struct display *p);
+void fbcon_cfb8_bmove(struct display *p, int sy, int sx, int dy, int dx, int height, int width);
+void fbcon_cfb8_clear(struct vc_data *conp, struct display *p, int sy, int sx, int height, int width);
+void fbcon_cfb8_putc(struct vc_data *conp, struct display *p, int c, int yy, int xx);
+void fbcon_cfb8_putcs(struct vc_data *conp, struct display *p, const unsigned short *s, int count, int yy, int xx);
+void fbcon_cfb8_revc(struct display *p, int xx, int yy);
+void fbcon_cfb8_clear_margins(struct vc_data *conp, struct display *p, int bottom_only);
+void fbcon_cfb16_setup(struct display *p);
+void fbcon_cfb16_bmove(struct display *p, int sy, int sx, int dy, int dx, int height, int width);
+void fbcon_cfb16_clear(struct vc_data *conp, struct display *p, int sy, int sx, int height, int width);
+void fbcon_cfb16_putc(struct vc_data *conp, struct display *p, int c, int yy, int xx);
+void fbcon_cfb16_putcs(struct vc_data *conp, struct display *p, const unsigned short *s, int count, int yy, int xx);
+void fbcon_cfb16_revc(struct display *p, int xx, int yy);
+void fbcon_cfb16_clear_margins(struct vc_data *conp, struct display *p, int bottom_only);
+
+/* harness side, see kshim.c */
+extern unsigned long long kshim_clock_ns;	/* virtual time */
+extern unsigned long long kshim_delay_ns;	/* ...of which spent in udelay() */
+extern unsigned long kshim_vram;		/* VRAM accesses by the CPU */
+extern unsigned int kshim_vram_ns;		/* charged for each of them */
+extern int kshim_verbose;			/* printk goes to stderr */
+void kshim_run_timers(void);			/* fire expired timers */
+extern int (*kshim_interrupt)(void);		/* the harness' interrupt handler */
+void kshim_irq_point(void);			/* ...may run here */
+extern void (*kshim_vram_sync)(void);		/* before the CPU touches VRAM */
+extern int (*kshim_vram_stream)(volatile void *a, unsigned int v); /* 1: write taken */
+
+#endif
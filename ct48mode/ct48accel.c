@@ -0,0 +1,249 @@
+
+/*
+ * ct48accel - drawing on the 65548 BitBLT engine from userspace
+ *
+ * Register usage follows ct48fb.c: DR00 pitch, DR02/DR03 colours, DR04
+ * control, DR05/DR06 source/destination and writing DR07 starts a blit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/fb.h>
+#include <linux/kd.h>
+
+#include "AsmMacros.h"
+#include "../module/ct48fb.h"
+#include "ct48accel.h"
+
+extern int iopl(int level);
+
+#define DR00	0x83d0
+#define DR02	0x8bd0
+#define DR03	0x8fd0
+#define DR04	0x93d0
+#define DR05	0x97d0
+#define DR06	0x9bd0
+#define DR07	0x9fd0
+
+#define ctTOP2BOTTOM	0x100
+#define ctLEFT2RIGHT	0x200
+#define ctSRCMONO	0x800
+#define ctPATMONO	0x1000
+#define ctSRCSYSTEM	0x4000
+#define ctPATSOLID	0x80000
+#define ctBUSY		0x100000
+
+#define ROPCOPY		0xCC	/* dest = source */
+#define ROPPATCOPY	0xF0	/* dest = pattern */
+
+#define TIMEOUT		1000000	/* status polls */
+
+static unsigned int color(struct ct48accel *a, unsigned int c)
+{
+	return (a->bpp == 8) ? (((c & 0xff) << 8) | (c & 0xff)) : (c & 0xffff);
+}
+
+static void wait_idle(struct ct48accel *a)
+{
+	int i;
+
+	for (i = 0; i < TIMEOUT; i++)
+		if (!(inl(DR04) & ctBUSY))
+			return;
+	a->timeouts++;
+}
+
+/* registers can only be written while the engine is idle */
+static void blit(struct ct48accel *a, unsigned int rop, unsigned int pitch,
+		 unsigned int src, unsigned int dst, int w, int h)
+{
+	wait_idle(a);
+	outl(DR04, rop);
+	outl(DR00, pitch);
+	outl(DR05, src);
+	outl(DR06, dst);
+	outl(DR07, ((h & 0xfff) << 16) | ((w * (a->bpp >> 3)) & 0xfff));
+}
+
+static int clip(struct ct48accel *a, int x, int y, int w, int h)
+{
+	return (w > 0) && (h > 0) && (x >= 0) && (y >= 0) &&
+	       (x + w <= a->xres) && (y + h <= a->yres);
+}
+
+int ct48_open(struct ct48accel *a, const char *dev, int usehw)
+{
+	struct fb_fix_screeninfo fix;
+	struct fb_var_screeninfo var;
+
+	memset(a, 0, sizeof(*a));
+	a->tty = -1;
+	a->fd = open(dev, O_RDWR);
+	if (a->fd < 0)
+		return -1;
+	if (ioctl(a->fd, FBIOGET_FSCREENINFO, &fix) || ioctl(a->fd, FBIOGET_VSCREENINFO, &var)) {
+		close(a->fd);
+		return -1;
+	}
+	a->xres = var.xres_virtual;
+	a->yres = var.yres_virtual;
+	a->bpp = var.bits_per_pixel;
+	a->line = fix.line_length;
+	a->size = fix.smem_len;
+	a->fb = mmap(NULL, a->size, PROT_READ | PROT_WRITE, MAP_SHARED, a->fd, 0);
+	if ((a->fb == MAP_FAILED) || ((a->bpp != 8) && (a->bpp != 16))) {
+		close(a->fd);
+		return -1;
+	}
+	/* engine widths are 12 bits of bytes */
+	if (a->xres * (a->bpp >> 3) > 0xfff)
+		usehw = 0;
+
+	if (usehw && !iopl(3) && !ioctl(a->fd, CT48FB_ENGINE_ACQUIRE)) {
+		a->hw = 1;
+		/* keep fbcon from drawing over us, it repaints when we're gone */
+		if (isatty(0) && !ioctl(0, KDSETMODE, KD_GRAPHICS))
+			a->tty = 0;
+	}
+	return 0;
+}
+
+void ct48_close(struct ct48accel *a)
+{
+	if (a->hw) {
+		ct48_sync(a);
+		ioctl(a->fd, CT48FB_ENGINE_RELEASE);
+		iopl(0);
+	}
+	if (a->tty >= 0)
+		ioctl(a->tty, KDSETMODE, KD_TEXT);
+	munmap(a->fb, a->size);
+	close(a->fd);
+}
+
+void ct48_sync(struct ct48accel *a)
+{
+	if (a->hw)
+		wait_idle(a);
+}
+
+void ct48_fill(struct ct48accel *a, int x, int y, int w, int h, unsigned int c)
+{
+	unsigned char *p;
+	unsigned short *q;
+	int i;
+
+	if (!clip(a, x, y, w, h))
+		return;
+	if (a->hw) {
+		wait_idle(a);
+		outl(DR02, color(a, c));
+		outl(DR03, color(a, c));
+		blit(a, ROPPATCOPY | ctTOP2BOTTOM | ctLEFT2RIGHT | ctPATSOLID | ctPATMONO,
+		     (a->line & 0xfff) << 16, 0, y * a->line + x * (a->bpp >> 3), w, h);
+		return;
+	}
+
+	p = a->fb + y * a->line + x * (a->bpp >> 3);
+	for (; h > 0; h--, p += a->line) {
+		if (a->bpp == 8) {
+			memset(p, c, w);
+		} else {
+			q = (unsigned short *)p;
+			for (i = 0; i < w; i++)
+				q[i] = c;
+		}
+	}
+}
+
+void ct48_copy(struct ct48accel *a, int sx, int sy, int dx, int dy, int w, int h)
+{
+	int bpp = a->bpp >> 3;
+	unsigned int src, dst, rop;
+	int step;
+
+	if (!clip(a, sx, sy, w, h) || !clip(a, dx, dy, w, h))
+		return;
+	src = sy * a->line + sx * bpp;
+	dst = dy * a->line + dx * bpp;
+
+	if (a->hw) {
+		/* same direction rules as ct48fb_blt_copycmd() */
+		rop = ROPCOPY;
+		if (sx < dx) {
+			src += w * bpp - 1;
+			dst += w * bpp - 1;
+		} else {
+			rop |= ctLEFT2RIGHT;
+		}
+		if (sy < dy) {
+			src += (h - 1) * a->line;
+			dst += (h - 1) * a->line;
+		} else {
+			rop |= ctTOP2BOTTOM;
+		}
+		blit(a, rop, ((a->line & 0xfff) << 16) | (a->line & 0xfff), src, dst, w, h);
+		return;
+	}
+
+	step = a->line;
+	if (sy < dy) {
+		src += (h - 1) * a->line;
+		dst += (h - 1) * a->line;
+		step = -step;
+	}
+	for (; h > 0; h--, src += step, dst += step)
+		memmove(a->fb + dst, a->fb + src, w * bpp);
+}
+
+void ct48_mono(struct ct48accel *a, int x, int y, int w, int h,
+	       const unsigned char *bits, int pitch, unsigned int fg, unsigned int bg)
+{
+	volatile unsigned int *port = (volatile unsigned int *)a->fb;
+	int bytes = (w + 7) / 8;
+	unsigned int data;
+	unsigned char *p;
+	int i, j, n;
+
+	if (!clip(a, x, y, w, h))
+		return;
+	if (a->hw) {
+		wait_idle(a);
+		outl(DR02, color(a, bg));
+		outl(DR03, color(a, fg));
+		blit(a, ROPCOPY | ctTOP2BOTTOM | ctLEFT2RIGHT | ctSRCMONO | ctSRCSYSTEM,
+		     (a->line & 0xfff) << 16, 0, y * a->line + x * (a->bpp >> 3), w, h);
+		/* the engine eats dwords, every line starts a new one, byte 0 first */
+		for (i = 0; i < h; i++, bits += pitch) {
+			data = 0;
+			n = 0;
+			for (j = 0; j < bytes; j++) {
+				data |= bits[j] << (8 * n);
+				if (++n == 4) {
+					*port = data;
+					data = 0;
+					n = 0;
+				}
+			}
+			if (n)
+				*port = data;
+		}
+		return;
+	}
+
+	for (i = 0; i < h; i++, bits += pitch) {
+		p = a->fb + (y + i) * a->line + x * (a->bpp >> 3);
+		for (j = 0; j < w; j++) {
+			data = (bits[j >> 3] & (0x80 >> (j & 7))) ? fg : bg;
+			if (a->bpp == 8)
+				p[j] = data;
+			else
+				((unsigned short *)p)[j] = data;
+		}
+	}
+}
@@ -0,0 +1,40 @@
+
+/*
+ * ct48accel - drawing on the 65548 BitBLT engine from userspace
+ *
+ * The DR registers are programmed directly through I/O ports (needs root
+ * for iopl(3), like ct48mode). The kernel driver is asked for the engine
+ * first, see CT48FB_ENGINE_ACQUIRE in ct48fb.h. If that or iopl fails
+ * everything is drawn by the CPU into the mmap'd framebuffer instead.
+ *
+ * Colours are pixel values: palette index in 8bpp, RGB565 in 16bpp.
+ */
+
+#ifndef _CT48ACCEL_H
+#define _CT48ACCEL_H
+
+struct ct48accel {
+	int fd;				/* /dev/fb* */
+	int tty;			/* console put into KD_GRAPHICS, -1 if none */
+	unsigned char *fb;		/* mmap'd framebuffer */
+	unsigned long size;
+	int xres, yres, bpp;
+	int line;			/* bytes per line */
+	int hw;				/* 1 when the engine is ours */
+	unsigned long timeouts;		/* engine didn't go idle */
+};
+
+/* usehw=0 forces CPU drawing; returns 0 on success */
+int ct48_open(struct ct48accel *a, const char *dev, int usehw);
+void ct48_close(struct ct48accel *a);
+
+void ct48_fill(struct ct48accel *a, int x, int y, int w, int h, unsigned int color);
+void ct48_copy(struct ct48accel *a, int sx, int sy, int dx, int dy, int w, int h);
+/* 1bpp bitmap, bit 7 of the first byte is leftmost; pitch in bytes */
+void ct48_mono(struct ct48accel *a, int x, int y, int w, int h,
+	       const unsigned char *bits, int pitch, unsigned int fg, unsigned int bg);
+
+/* wait for the engine before touching a->fb directly */
+void ct48_sync(struct ct48accel *a);
+
+#endif
@@ -0,0 +1,115 @@
+
+/*
+ * ct48bench - BitBLT engine against plain CPU drawing, through ct48accel
+ *
+ * usage: ct48bench [/dev/fbN]
+ * Prints rectangles per second for typical UI sizes, engine and CPU.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "ct48accel.h"
+
+#define RUNTIME	500000		/* us per test */
+
+static const struct {
+	int w, h;
+	const char *what;
+} sizes[] = {
+	{ 8, 16, "glyph" },
+	{ 16, 16, "icon" },
+	{ 80, 24, "button" },
+	{ 200, 20, "menu item" },
+	{ 300, 200, "window" },
+	{ 640, 480, "screen" },
+	{ 0, 0, NULL }
+};
+
+enum { FILL, COPY, MONO };
+static const char *opname[] = { "fill", "copy", "mono" };
+
+static unsigned char bitmap[640 / 8 * 480];
+
+static long now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000L + tv.tv_usec;
+}
+
+/* rectangles per second */
+static double run(struct ct48accel *a, int op, int w, int h)
+{
+	long start, t;
+	int n, x, y;
+
+	if ((w > a->xres) || (h > a->yres / 2))
+		return 0;
+	n = 0;
+	start = now();
+	do {
+		x = (n * 8) % (a->xres - w + 1);
+		y = (n * 8) % (a->yres / 2 - h + 1);
+		switch (op) {
+		case FILL:
+			ct48_fill(a, x, y, w, h, n & 0x0f);
+			break;
+		case COPY:
+			ct48_copy(a, x, y + a->yres / 2 - h, x, y, w, h);
+			break;
+		case MONO:
+			ct48_mono(a, x, y, w, h, bitmap, (w + 7) / 8, 15, n & 0x0f);
+			break;
+		}
+		n++;
+		if (!(n & 15))
+			ct48_sync(a);
+		t = now() - start;
+	} while (t < RUNTIME);
+	ct48_sync(a);
+	t = now() - start;
+	return n * 1000000.0 / t;
+}
+
+int main(int argc, char *argv[])
+{
+	struct ct48accel hw, cpu;
+	const char *dev = (argc > 1) ? argv[1] : "/dev/fb0";
+	double rh, rc;
+	int i, op;
+
+	if (ct48_open(&cpu, dev, 0)) {
+		fprintf(stderr, "Can't open %s\n", dev);
+		return 1;
+	}
+	if (ct48_open(&hw, dev, 1) || !hw.hw) {
+		fprintf(stderr, "BitBLT engine not available (need root and ct48fb with accel)\n");
+		ct48_close(&cpu);
+		return 2;
+	}
+	for (i = 0; i < sizeof(bitmap); i++)
+		bitmap[i] = (i & 1) ? 0x55 : 0xaa;
+
+	printf("%dx%d, %d bpp\n", hw.xres, hw.yres, hw.bpp);
+	printf("%-5s %-10s %9s %12s %12s %8s\n", "op", "size", "", "engine/s", "cpu/s", "speedup");
+	for (op = FILL; op <= MONO; op++) {
+		for (i = 0; sizes[i].what; i++) {
+			rh = run(&hw, op, sizes[i].w, sizes[i].h);
+			rc = run(&cpu, op, sizes[i].w, sizes[i].h);
+			if (!rh || !rc)
+				continue;
+			printf("%-5s %4dx%-5d %9s %12.0f %12.0f %7.2fx\n", opname[op],
+			       sizes[i].w, sizes[i].h, sizes[i].what, rh, rc, rh / rc);
+		}
+	}
+	if (hw.timeouts)
+		printf("engine timed out %lu times\n", hw.timeouts);
+
+	ct48_close(&hw);
+	ct48_close(&cpu);
+	return 0;
+}
@@ -15,6 +15,15 @@
 
 static int currcon = 0;
 
+/*
+ * Colormaps go to the hardware one setcolreg() per entry unless the
+ * driver has its own fbgen_load_cmap().
+ */
+#ifndef fbgen_load_cmap
+#define fbgen_load_cmap(cmap, kspc, info) \
+	fb_set_cmap((cmap), (kspc), (info)->fbhw->setcolreg, &(info)->info)
+#endif
+
 
 /* ---- `Generic' versions of the frame buffer device operations ----------- */
 
@@ -96,7 +105,8 @@ int fbgen_set_var(struct fb_var_screeninfo *var, int con, struct fb_info *info)
 {
     struct fb_info_gen *info2 = (struct fb_info_gen *)info;
     int err;
-    int oldxres, oldyres, oldbpp, oldxres_virtual, oldyres_virtual, oldyoffset;
+    int oldxres, oldyres, oldbpp, oldxres_virtual, oldyres_virtual;
+    int oldaccel;
     struct fb_bitfield oldred, oldgreen, oldblue;
 
     if ((err = fbgen_do_set_var(var, con == currcon, info2)))
@@ -110,16 +120,17 @@ int fbgen_set_var(struct fb_var_screeninfo *var, int con, struct fb_info *info)
 	oldred = fb_display[con].var.red;
 	oldgreen = fb_display[con].var.green;
 	oldblue = fb_display[con].var.blue;
-	oldyoffset = fb_display[con].var.yoffset;
+	oldaccel = fb_display[con].var.accel_flags;
 	fb_display[con].var = *var;
+	/* a new yoffset alone is a pan, set_par has moved the start already */
 	if (oldxres != var->xres || oldyres != var->yres ||
 	    oldxres_virtual != var->xres_virtual ||
 	    oldyres_virtual != var->yres_virtual ||
 	    oldbpp != var->bits_per_pixel ||
-	    (!(memcmp(&oldred, &(var->red), sizeof(struct fb_bitfield)))) || 
-	    (!(memcmp(&oldgreen, &(var->green), sizeof(struct fb_bitfield)))) ||
-	    (!(memcmp(&oldblue, &(var->blue), sizeof(struct fb_bitfield)))) ||
-	    oldyoffset != var->yoffset) {
+	    memcmp(&oldred, &(var->red), sizeof(struct fb_bitfield)) ||
+	    memcmp(&oldgreen, &(var->green), sizeof(struct fb_bitfield)) ||
+	    memcmp(&oldblue, &(var->blue), sizeof(struct fb_bitfield)) ||
+	    oldaccel != var->accel_flags) {	/* picks the display switch */
 	    fbgen_set_disp(con, info2);
 	    if (info->changevar)
 		(*info->changevar)(con);
@@ -184,7 +195,6 @@ int fbgen_set_cmap(struct fb_cmap *cmap, int kspc, int con,
 		   struct fb_info *info)
 {
     struct fb_info_gen *info2 = (struct fb_info_gen *)info;
-    struct fbgen_hwswitch *fbhw = info2->fbhw;
     int err;
 
     if (!fb_display[con].cmap.len) {	/* no colormap allocated ? */
@@ -193,7 +203,7 @@ int fbgen_set_cmap(struct fb_cmap *cmap, int kspc, int con,
 	    return err;
     }
     if (con == currcon)			/* current console ? */
-	return fb_set_cmap(cmap, kspc, fbhw->setcolreg, info);
+	return fbgen_load_cmap(cmap, kspc, info2);
     else
 	fb_copy_cmap(cmap, &fb_display[con].cmap, kspc ? 0 : 1);
     return 0;
@@ -224,11 +234,18 @@ int fbgen_pan_display(struct fb_var_screeninfo *var, int con,
     int yoffset = var->yoffset;
     int err;
 
-    if (xoffset < 0 ||
-	xoffset+fb_display[con].var.xres > fb_display[con].var.xres_virtual ||
-	yoffset < 0 ||
-	yoffset+fb_display[con].var.yres > fb_display[con].var.yres_virtual)
-	return -EINVAL;
+    if (var->vmode & FB_VMODE_YWRAP) {
+	/* the screen may run past the end and continue at the top */
+	if (xoffset || yoffset < 0 ||
+	    yoffset >= fb_display[con].var.yres_virtual)
+	    return -EINVAL;
+    } else {
+	if (xoffset < 0 ||
+	    xoffset+fb_display[con].var.xres > fb_display[con].var.xres_virtual ||
+	    yoffset < 0 ||
+	    yoffset+fb_display[con].var.yres > fb_display[con].var.yres_virtual)
+	    return -EINVAL;
+    }
     if (con == currcon) {
 	if (fbhw->pan_display) {
 	    if ((err = fbhw->pan_display(var, info2)))
@@ -341,14 +358,13 @@ void fbgen_set_disp(int con, struct fb_info_gen *info)
 
 void fbgen_install_cmap(int con, struct fb_info_gen *info)
 {
-    struct fbgen_hwswitch *fbhw = info->fbhw;
     if (con != currcon)
 	return;
     if (fb_display[con].cmap.len)
-	fb_set_cmap(&fb_display[con].cmap, 1, fbhw->setcolreg, &info->info);
+	fbgen_load_cmap(&fb_display[con].cmap, 1, info);
     else {
 	int size = fb_display[con].var.bits_per_pixel == 16 ? 64 : 256;
-	fb_set_cmap(fb_default_cmap(size), 1, fbhw->setcolreg, &info->info);
+	fbgen_load_cmap(fb_default_cmap(size), 1, info);
     }
 }
 
@@ -436,7 +452,7 @@ void fbgen_blank(int blank, struct fb_info *info)
 	cmap.transp = NULL;
 	cmap.start = 0;
 	cmap.len = 16;
-	fb_set_cmap(&cmap, 1, fbhw->setcolreg, info);
+	fbgen_load_cmap(&cmap, 1, info2);
     } else
 	fbgen_install_cmap(currcon, info2);
 }
@@ -20,10 +20,12 @@
 
     OPTIONS:
     (kernel) noaccel/accel, noaccputc/accputc, nohwcursor/hwcursor, blink/noblink,
-    inverse/noinverse, mode:<xres>x<yres>x<bpp> (see the 4 available modes below)
+    inverse/noinverse, mmio/nommio, regtrace/noregtrace, ypan/noypan, ywrap/noywrap,
+    mode:<xres>x<yres>x<bpp> (see the available modes below, other sizes up to
+    the panel's get computed timings)
 
     DEFAULT OPTIONS:
-    video=ct48fb:accel:noaccputc:hwcursor:noblink:noinverse:mode:640x480x8
+    video=ct48fb:accel:accputc:hwcursor:noblink:noinverse:nommio:noregtrace:ypan:noywrap:mode:640x480x8
 */
 
 #include <linux/kernel.h>
@@ -37,15 +39,23 @@
 #include <linux/errno.h>
 #include <linux/string.h>
 #include <linux/console.h>
+#include <linux/sched.h>
+#include <linux/timer.h>
+#include <linux/tqueue.h>
+#include <linux/spinlock.h>
+#include <linux/proc_fs.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
 #include <video/fbcon.h>
 #include <video/fbcon-cfb8.h>
 #include <video/fbcon-cfb16.h>
 #include <asm/io.h>
+#include <asm/uaccess.h>
+#include <asm/semaphore.h>
 #include <linux/pci.h>
 #include "vga.h"
+#include "ct48fb.h"
 
-/* this is to have fbi return with correct screen offset */
-#define FBIFIX
 
 /* conversion between var and par structures' pixclock */
 #define PICOS2KHZ(a) (1000000000UL/(a))
@@ -55,15 +65,138 @@ struct ct48fb_cursor {
     int enable;
     int x,y;
     int w,h;
+    struct file *user;			/* the program that has it, NULL: console */
+    int pid;				/* ...who opened it, for /proc */
+    int con;				/* the console it was taken on */
+    int px, py, hot_x, hot_y;		/* where its hotspot is, the hotspot... */
+    int on;				/* ...whether it is shown... */
+    u_int pos, color;			/* ...DR0B, DR09... */
+    u32 image[64];			/* ...and image as the chip wants it */
+    u_int concolor;			/* DR09 of the console's cursor */
+};
+
+/* a cursor image kept in VRAM, DR0C points the chip at one of them */
+#define CT48_CURSOR_SLOTS	4
+
+struct ct48fb_cslot {
+    u32 image[64];			/* what the slot holds */
+    u_long used;			/* LRU stamp, 0: empty */
+};
+
+/* BitBLT command, register values exactly as they go to the chip */
+struct ct48fb_blt_cmd {
+    u_int flags;
+    u_int rop;				/* DR04 */
+    u_int pitch;			/* DR00 */
+    u_long src;				/* DR05 */
+    u_long dst;				/* DR06 */
+    u_int bg, fg;			/* DR02, DR03 */
+    u_int hw;				/* DR07, writing it starts the blit */
+    u_long pat;				/* DR01 */
+};
+
+#define CT48_BLT_SRC	0x01		/* command uses DR05 */
+#define CT48_BLT_COLOR	0x02		/* command uses DR02/DR03 */
+#define CT48_BLT_PAT	0x04		/* command uses DR01 */
+#define CT48_BLT_START	0x08		/* no blit, display start dst, line compare src */
+
+#define CT48_BLTQ_LEN	16		/* has to be a power of 2 */
+
+/* what the waits cost us, shown in /proc/driver/ct48fb */
+struct ct48fb_bltstat {
+    u_long blits;			/* commands started */
+    u_long waits;			/* waits that found the engine busy */
+    u_long polls;			/* DR04 status reads */
+    u_long wait_us;			/* time spent waiting */
+    u_long timeouts;
+    u_long skipped;			/* register writes saved by the shadow */
+};
+
+/*
+ * Last values written to the BitBLT registers that keep them. DR05-DR07
+ * are working registers the engine walks during a blit, they're always
+ * written.
+ */
+struct ct48fb_drshadow {
+    u_int valid;			/* bit n set: val[n] is what DRn holds */
+    u_int val[5];			/* DR00-DR04 */
+};
+
+struct ct48fb_bltq {
+    struct ct48fb_blt_cmd cmd[CT48_BLTQ_LEN];
+    u_int head, tail;			/* commands head..tail-1 are waiting */
+    spinlock_t lock;
+    struct timer_list timer;		/* drains the queue when nobody else does */
+    u_int inflight_us;			/* estimated run time of the last blit started */
+    u_long inflight_jiffies;		/* ...and when it was started */
+    struct ct48fb_bltstat stat;
+};
+
+/* who is driving the engine and VRAM right now */
+enum { CT48_OWN_NONE, CT48_OWN_TEXT, CT48_OWN_CURSOR, CT48_OWN_DRIVER, CT48_OWN_USER };
+
+struct ct48fb_own {
+    struct semaphore sem;
+    int owner;				/* CT48_OWN_*, NONE when free */
+    int last;				/* previous holder */
+    u_long handovers;			/* times it changed hands */
+    struct file *lease;			/* file driving the engine itself, NULL if none */
+    int lease_pid;			/* ...who took it, for /proc */
+    u_long dropped;			/* console drawing skipped meanwhile */
+};
+
+/* console font kept in offscreen VRAM for screen-to-screen expansion */
+struct ct48fb_glyphs {
+    u_char *font;			/* fontdata it was loaded from, NULL = invalid */
+    int w, h, count;
+    int ok;				/* 0 if the font didn't fit */
+    u_long base;			/* VRAM offset of glyph 0 */
+    u_int size;				/* bytes per glyph, dword aligned */
+};
+
+/* CRTC timings in pixels and lines, as in fb_var_screeninfo */
+struct ct48fb_timing {
+    u_int left, right, hsync;
+    u_int upper, lower, vsync;
+    u_int sync;				/* FB_SYNC_* */
 };
 
 struct ct48fb_par {
     int bpp;
+    int xres, yres;
+    struct ct48fb_timing t;
+    int tab;				/* ct48fb_tabmodes[] entry, -1: registers computed */
     u_long base;
     u_int pixclock;			/* in kHz */
     int linelength;
     int accel;
-    u_long cursor_base;
+    u_long screen_size;			/* virtual screen, offscreen VRAM starts here */
+};
+
+/*
+ * Offscreen VRAM: everything between the end of the virtual screen and
+ * the end of memory (CT48_VRAM_PANEL below it on a dual scan panel) is
+ * handed out in aligned blocks - cursor image,
+ * pattern slot, glyph cache and buffers of userspace programs. Changing
+ * the depth or the virtual screen starts it over. The caller owns the
+ * engine.
+ */
+#define CT48_VRAM_BLOCKS	32
+#define CT48_VRAM_USER		8	/* blocks one open file may have */
+#define CT48_VRAM_NONE		(~0UL)
+
+struct ct48fb_vblock {
+    u_long base, size;
+    const char *what;
+    struct file *file;			/* userspace owner, NULL for the driver */
+    int pid;				/* who opened it, for /proc */
+};
+
+struct ct48fb_vram {
+    u_long start;			/* first byte after the virtual screen */
+    u_long end;				/* the memory size, or where CT48_VRAM_PANEL starts */
+    int count;
+    struct ct48fb_vblock blk[CT48_VRAM_BLOCKS];	/* sorted by base */
 };
 
 struct ct48fb_info {
@@ -77,27 +210,63 @@ struct ct48fb_info {
 
     struct ct48fb_par currentmode;
     struct ct48fb_cursor cursor;
+    struct ct48fb_bltq bltq;
+    struct ct48fb_drshadow shadow;
+    struct ct48fb_own own;
+    struct ct48fb_glyphs glyphs;
+    u_char pattern[8];			/* what's in the pattern slot */
+    int pattern_ok;
+    struct ct48fb_vram vram;
+    u_long cursor_base;			/* cursor image slots, CT48_VRAM_NONE if none */
+    struct ct48fb_cslot cslot[CT48_CURSOR_SLOTS];
+    int cslot_cur;			/* the one DR0C has */
+    u_long cslot_clock;
+    u_long cslot_loads, cslot_switches;
+    u_long pattern_base;		/* pattern slot */
+    struct timer_list cmap_timer;	/* puts queued palette entries out at retrace */
+    int cmap_tries;			/* ticks it has looked for one */
+    struct tq_struct restore_task;	/* unblank from interrupt context */
+    int panel_up;			/* the panel was powered up, unblank sets the mode the long way */
+    int reread;				/* the chip may not hold currentmode, set_par reads it back */
+    int con;				/* console on the screen, fbgen's currcon */
+    int deferred;			/* CT48_DEFER_*, waiting for the end of a lease */
+    struct ct48fb_par deferred_par;
 };
 
+/* what a lease holds up */
+#define CT48_DEFER_PAR		0x01	/* set_par */
+#define CT48_DEFER_RESTORE	0x02	/* the mode check after unblanking */
+#define CT48_DEFER_CURSOR	0x04	/* a program's pointer shown or hidden */
+
+/* a program's pointer is on the screen, not the console's text cursor */
+static inline int ct48fb_cursor_user(struct ct48fb_info *i)
+{
+    return i->cursor.user && (i->cursor.con == i->con);
+}
+
 static struct ct48fb_info fb_info;
 static struct display disp;
 static struct pci_dev *ct48fb_pci_dev;
 
-static struct { u_char red, green, blue, transp; } palette[256];
+static struct { u16 red, green, blue, transp; } palette[256];
 static int pseudo_pal[16];
 static struct fb_var_screeninfo default_var;
 static char ct48fb_name[] = "ct48fb";
 
 /* options */
 static int noaccel = 0;			/* enable acceleration by default */
-static int noaccputc = 1;		/* disable accelerated putc by default */
+static int noaccputc = 0;		/* enable accelerated putc by default */
 static int nohwcursor = 0;		/* enable hardware cursor by default */
 static int noblink = 1;			/* disable hw cursor blink as it looks like shit */
 static int noinverse = 1;		/* disable screen inverse */
+static int nommio = 1;			/* DR registers through port I/O by default */
+static int noregtrace = 1;		/* don't trace register accesses */
+static int noypan = 0;			/* scroll console by moving display start */
+static int noywrap = 1;			/* no wrap-around scrolling through line compare */
 static char *mode = NULL;		/* selected video mode upon start */
-static volatile int wasbmove = 0;	/* hack for accelerated putc */
 /* global helper variables */
 static int modenum = 0;			/* selected video mode table offset upon start */
+static int mode_xres, mode_yres;	/* size of a mode:WxHxB that isn't predefined */
 static int bpp = 8;			/* this tracks current bpp mode */
 static int pci_mode = 0;                /* true, if detection of a pci board succeeded */
 
@@ -108,30 +277,41 @@ static const struct {
     { "640x480x8",	/* 640x480, 8 bpp */
 	{ 640, 480, 640, 480, 0, 0, 8, 0,
 	  {0, 6, 0}, {0, 6, 0}, {0, 6, 0}, {0, 0, 0},
-	  0, FB_ACTIVATE_NOW, -1, -1, FB_ACCEL_NONE, 25000, 64, 64, 32, 32, 64, 2,
-	  0, FB_VMODE_NONINTERLACED }
+	  0, FB_ACTIVATE_NOW, -1, -1, FB_ACCEL_NONE, 25000, 56, 24, 32, 32, 96, 2,
+	  FB_SYNC_HOR_HIGH_ACT|FB_SYNC_VERT_HIGH_ACT, FB_VMODE_NONINTERLACED }
     },
     { "640x480x16",     /* 640x480, 16 bpp */
 	{ 640, 480, 640, 480, 0, 0, 16, 0,
 	  {0, 5, 0}, {5, 6, 0}, {11, 5, 0}, {0, 0, 0},
-	  0, FB_ACTIVATE_NOW, -1, -1, FB_ACCEL_NONE, 20000, 64, 64, 32, 32, 64, 2,
-	  0, FB_VMODE_NONINTERLACED }
+	  0, FB_ACTIVATE_NOW, -1, -1, FB_ACCEL_NONE, 20000, 56, 24, 32, 32, 96, 2,
+	  FB_SYNC_HOR_HIGH_ACT|FB_SYNC_VERT_HIGH_ACT, FB_VMODE_NONINTERLACED }
     },
     { "800x600x8",	/* 800x600, 8 bpp */
 	{ 800, 600, 800, 600, 0, 0, 8, 0,
 	  {0, 6, 0}, {0, 6, 0}, {0, 6, 0}, {0, 0, 0},
-	  0, FB_ACTIVATE_NOW, -1, -1, FB_ACCEL_NONE, 25000, 64, 64, 32, 32, 64, 2,
+	  0, FB_ACTIVATE_NOW, -1, -1, FB_ACCEL_NONE, 25000, 96, 48, 32, 32, 128, 2,
+	  0, FB_VMODE_NONINTERLACED }
+    },
+    { "800x600x16",     /* 800x600, 16 bpp, 800x592 on a dual scan panel */
+	{ 800, 600, 800, 600, 0, 0, 16, 0,
+	  {0, 5, 0}, {5, 6, 0}, {11, 5, 0}, {0, 0, 0},
+	  0, FB_ACTIVATE_NOW, -1, -1, FB_ACCEL_NONE, 20000, 96, 48, 32, 32, 128, 2,
 	  0, FB_VMODE_NONINTERLACED }
     },
     { "800x592x16",     /* 800x592, 16 bpp */
 	{ 800, 592, 800, 592, 0, 0, 16, 0,
 	  {0, 5, 0}, {5, 6, 0}, {11, 5, 0}, {0, 0, 0},
-	  0, FB_ACTIVATE_NOW, -1, -1, FB_ACCEL_NONE, 20000, 64, 64, 32, 32, 64, 2,
+	  0, FB_ACTIVATE_NOW, -1, -1, FB_ACCEL_NONE, 20000, 96, 48, 32, 32, 128, 2,
 	  0, FB_VMODE_NONINTERLACED }
     },
     { "\0", },
 };
 
+static int ct48fb_ioctl(struct inode *inode, struct file *file, u_int cmd,
+			u_long arg, int con, struct fb_info *info);
+static int ct48fb_release(struct fb_info *info, int user);
+static void ct48fb_cmap_timer(unsigned long data);
+
 static struct fb_ops ct48fb_ops = {
 	owner:		THIS_MODULE,
 	fb_get_fix:	fbgen_get_fix,
@@ -140,6 +320,8 @@ static struct fb_ops ct48fb_ops = {
 	fb_get_cmap:	fbgen_get_cmap,
 	fb_set_cmap:	fbgen_set_cmap,
 	fb_pan_display:	fbgen_pan_display,
+	fb_release:	ct48fb_release,
+	fb_ioctl:	ct48fb_ioctl,
 };
 /* -----------------PCI ---------------------------------------------------- */
 static struct pci_driver ct48fb_pci_driver;
@@ -176,6 +358,21 @@ static struct pci_driver ct48fb_pci_driver = {
 };
 /* ------------------- low level functions --------------------------------- */
 
+/*
+ * With a dual scan panel and frame acceleration on the top 96000+1024
+ * bytes of VRAM are left alone. What is there isn't documented, most
+ * likely the frame accelerator buffer the BIOS sets up for the 410CS's
+ * panel (a fifth of a byte per pixel). Other panels don't have one.
+ */
+#define CT48_VRAM_PANEL		(96000 + 1024)
+
+/* offscreen VRAM the virtual screen has to leave free, the glyph cache if it can */
+#define CT48_CURSOR_SIZE	1024	/* DR0C wants 1K alignment */
+#define CT48_PATTERN_SIZE	128	/* 8x8 pattern, room for a 16bpp one */
+#define CT48_GLYPHS_SIZE	(256*64)	/* 256 glyphs up to 16x32 */
+#define CT48_VRAM_FIXED		(CT48_CURSOR_SLOTS * CT48_CURSOR_SIZE + CT48_PATTERN_SIZE)
+#define CT48_VRAM_RESERVE	(CT48_VRAM_FIXED + CT48_GLYPHS_SIZE)
+
 /* reference clock frequency [kHz] */
 #define CT48_REFERENCE_CLOCK 14318
 
@@ -185,6 +382,7 @@ static struct pci_driver ct48fb_pci_driver = {
 
 /* extra blitter register */
 #define DR00	0x83d0
+#define DR01	0x87d0
 #define DR02	0x8bd0
 #define DR03	0x8fd0
 #define DR04	0x93d0
@@ -197,11 +395,279 @@ static struct pci_driver ct48fb_pci_driver = {
 #define DR0B	0xafd0
 #define DR0C	0xb3d0
 
+/*
+ * Register access
+ *
+ * All register traffic goes through ct48_regs. VGA and XR registers are
+ * 8-bit ports, DR registers are named by their I/O port (DR00-DR0C) and
+ * the backend decides how to reach them:
+ *  pio   - plain port I/O, works everywhere
+ *  mmio  - DR registers memory mapped above the frame buffer (PCI only),
+ *          VGA registers still go through ports as they aren't mapped
+ *  trace - wraps one of the above and keeps the last accesses for /proc
+ *  sim   - in-memory register file, for running the driver without a chip
+ */
+struct ct48fb_regops {
+    const char *name;
+    u_char (*r8)(u_short port);
+    void (*w8)(u_short port, u_char val);
+    u_int (*r32)(u_short dr);
+    void (*w32)(u_short dr, u_int val);
+};
+
+/* DR register number from its port, A14-A10 select one of 32 */
+#define CT48_DR(dr)	(((dr) >> 10) & 0x1f)
+
+static u_char ct48_pio_r8(u_short port)
+{
+    return vga_io_r(port);
+}
+static void ct48_pio_w8(u_short port, u_char val)
+{
+    vga_io_w(port, val);
+}
+static u_int ct48_pio_r32(u_short dr)
+{
+    return inl(dr);
+}
+static void ct48_pio_w32(u_short dr, u_int val)
+{
+    outl(val, dr);
+}
+
+static struct ct48fb_regops ct48_pio_regs = {
+    name:	"pio",
+    r8:		ct48_pio_r8,
+    w8:		ct48_pio_w8,
+    r32:	ct48_pio_r32,
+    w32:	ct48_pio_w32,
+};
+
+/* with A21 set a PCI memory cycle hits the 32-bit registers instead of VRAM */
+#define CT48_MMIO_OFFSET	0x200000
+#define CT48_MMIO_SIZE		0x8000
+
+static caddr_t ct48_mmio_base;
+
+static u_int ct48_mmio_r32(u_short dr)
+{
+    return readl(ct48_mmio_base + (CT48_DR(dr) << 10));
+}
+static void ct48_mmio_w32(u_short dr, u_int val)
+{
+    writel(val, ct48_mmio_base + (CT48_DR(dr) << 10));
+}
+
+static struct ct48fb_regops ct48_mmio_regs = {
+    name:	"mmio",
+    r8:		ct48_pio_r8,
+    w8:		ct48_pio_w8,
+    r32:	ct48_mmio_r32,
+    w32:	ct48_mmio_w32,
+};
+
+#define CT48_TRACE_LEN	64		/* has to be a power of 2 */
+
+static struct {
+    u_char op;				/* r/w for 8-bit, R/W for 32-bit access */
+    u_short port;
+    u_int val;
+} ct48_trace[CT48_TRACE_LEN];
+static u_int ct48_trace_pos;
+static struct ct48fb_regops *ct48_traced;	/* what the trace wraps */
+
+static inline void ct48_trace_add(u_char op, u_short port, u_int val)
+{
+    u_int i = ct48_trace_pos++ & (CT48_TRACE_LEN-1);
+
+    ct48_trace[i].op = op;
+    ct48_trace[i].port = port;
+    ct48_trace[i].val = val;
+}
+static u_char ct48_trace_r8(u_short port)
+{
+    u_char val = ct48_traced->r8(port);
+
+    ct48_trace_add('r', port, val);
+    return val;
+}
+static void ct48_trace_w8(u_short port, u_char val)
+{
+    ct48_trace_add('w', port, val);
+    ct48_traced->w8(port, val);
+}
+static u_int ct48_trace_r32(u_short dr)
+{
+    u_int val = ct48_traced->r32(dr);
+
+    ct48_trace_add('R', dr, val);
+    return val;
+}
+static void ct48_trace_w32(u_short dr, u_int val)
+{
+    ct48_trace_add('W', dr, val);
+    ct48_traced->w32(dr, val);
+}
+
+static struct ct48fb_regops ct48_trace_regs = {
+    name:	"trace",
+    r8:		ct48_trace_r8,
+    w8:		ct48_trace_w8,
+    r32:	ct48_trace_r32,
+    w32:	ct48_trace_w32,
+};
+
+#ifdef CT48FB_SIM
+/* simulated chip, the VRAM side is up to whoever sets fbmem_virt */
+struct ct48fb_sim {
+    u_char port[32];			/* 0x3c0-0x3df, index registers included */
+    u_char xr[256], cr[256], gr[256], sr[256], ar[32];
+    u_char dac[256*3];
+    u_int dac_pos;
+    int ar_data;			/* attribute controller flip-flop */
+    u_int dr[32];
+    void (*blit)(struct ct48fb_sim *s);	/* DR07 was just written */
+    u_long reads, writes;
+};
+
+static struct ct48fb_sim ct48_sim;
+
+static u_char *ct48_sim_reg(u_short port)
+{
+    struct ct48fb_sim *s = &ct48_sim;
+
+    switch (port) {
+	case VGA_XR_D:
+	    return &s->xr[s->port[VGA_XR_I & 0x1f]];
+	case VGA_CRT_DC:
+	    return &s->cr[s->port[VGA_CRT_IC & 0x1f]];
+	case VGA_GFX_D:
+	    return &s->gr[s->port[VGA_GFX_I & 0x1f]];
+	case VGA_SEQ_D:
+	    return &s->sr[s->port[VGA_SEQ_I & 0x1f]];
+	case VGA_ATT_R:
+	    return &s->ar[s->port[VGA_ATT_W & 0x1f] & 0x1f];
+	case VGA_PEL_D:				/* auto-increments */
+	    return &s->dac[s->dac_pos++ % (256*3)];
+	default:
+	    return &s->port[port & 0x1f];
+    }
+}
+static u_char ct48_sim_r8(u_short port)
+{
+    ct48_sim.reads++;
+    if (port == VGA_IS1_RC) {
+	ct48_sim.ar_data = 0;
+	/* a very fast CRTC: in and out of retrace every 16 reads */
+	if (!(ct48_sim.reads & 15))
+	    ct48_sim.port[VGA_IS1_RC & 0x1f] ^= 0x09;
+    }
+    return *ct48_sim_reg(port);
+}
+static void ct48_sim_w8(u_short port, u_char val)
+{
+    struct ct48fb_sim *s = &ct48_sim;
+
+    s->writes++;
+    switch (port) {
+	case VGA_ATT_W:
+	    if (s->ar_data)
+		s->ar[s->port[VGA_ATT_W & 0x1f] & 0x1f] = val;
+	    else
+		s->port[VGA_ATT_W & 0x1f] = val;
+	    s->ar_data ^= 1;
+	    return;
+	case VGA_PEL_IW:
+	case VGA_PEL_IR:
+	    s->dac_pos = val * 3;
+	    break;
+    }
+    *ct48_sim_reg(port) = val;
+}
+static u_int ct48_sim_r32(u_short dr)
+{
+    ct48_sim.reads++;
+    return ct48_sim.dr[CT48_DR(dr)];
+}
+static void ct48_sim_w32(u_short dr, u_int val)
+{
+    ct48_sim.writes++;
+    ct48_sim.dr[CT48_DR(dr)] = val;
+    if ((dr == DR07) && ct48_sim.blit)
+	ct48_sim.blit(&ct48_sim);
+}
+
+static struct ct48fb_regops ct48_sim_regs = {
+    name:	"sim",
+    r8:		ct48_sim_r8,
+    w8:		ct48_sim_w8,
+    r32:	ct48_sim_r32,
+    w32:	ct48_sim_w32,
+};
+#endif /* CT48FB_SIM */
+
+static struct ct48fb_regops *ct48_regs = &ct48_pio_regs;
+
+/* change the backend, tracing stays on top of it */
+static void ct48fb_use_regs(struct ct48fb_regops *ops)
+{
+    if (ct48_regs == &ct48_trace_regs)
+	ct48_traced = ops;
+    else
+	ct48_regs = ops;
+}
+
+static void ct48fb_trace_regs(void)
+{
+    if (ct48_regs == &ct48_trace_regs)
+	return;
+    ct48_traced = ct48_regs;
+    ct48_regs = &ct48_trace_regs;
+}
+
+static __init void ct48fb_mmio_init(void)
+{
+    u_long base;
+
+    if (!pci_mode) {
+	printk(KERN_INFO "ct48fb: memory mapped registers need PCI, using port I/O\n");
+	return;
+    }
+    base = pci_resource_start(ct48fb_pci_dev, 0) + CT48_MMIO_OFFSET;
+    ct48_mmio_base = ioremap(base, CT48_MMIO_SIZE);
+    if (!ct48_mmio_base) {
+	printk(KERN_WARNING "ct48fb: cannot ioremap registers @ 0x%lx, using port I/O\n", base);
+	return;
+    }
+    ct48fb_use_regs(&ct48_mmio_regs);
+    printk(KERN_INFO "ct48fb: DR registers memory mapped @ 0x%lx\n", base);
+}
+
+/* plain VGA ports */
+#define write_vga(port, val)	ct48_regs->w8((port), (val))
+#define read_vga(port, var)	do { var = ct48_regs->r8((port)); } while (0)
+/* 32-bit DR registers */
+#define write_dr(dr, val)	ct48_regs->w32((dr), (val))
+#define read_dr(dr, var)	do { var = ct48_regs->r32((dr)); } while (0)
+
+/*
+ * Index/data pairs. The drain timer moves the display start and blanking
+ * comes from the console timer, both without the engine, so a pair must
+ * not be split by them.
+ */
+static spinlock_t CHIPS_reglock = SPIN_LOCK_UNLOCKED;
+
 #define write_ind(num, val, ap, dp)	do { \
-	vga_io_w((ap), (num)); vga_io_w((dp), (val)); \
+	u_long _rf; \
+	spin_lock_irqsave(&CHIPS_reglock, _rf); \
+	write_vga((ap), (num)); write_vga((dp), (val)); \
+	spin_unlock_irqrestore(&CHIPS_reglock, _rf); \
 } while (0)
 #define read_ind(num, val, ap, dp)	do { \
-	vga_io_w((ap), (num)); val = vga_io_r((dp)); \
+	u_long _rf; \
+	spin_lock_irqsave(&CHIPS_reglock, _rf); \
+	write_vga((ap), (num)); read_vga((dp), val); \
+	spin_unlock_irqrestore(&CHIPS_reglock, _rf); \
 } while (0)
 
 /* extension registers */
@@ -216,12 +682,27 @@ static struct pci_driver ct48fb_pci_driver = {
 /* sequencer registers */
 #define write_sr(num, val)	write_ind(num, val, VGA_SEQ_I, VGA_SEQ_D)
 #define read_sr(num, var)	read_ind(num, var, VGA_SEQ_I, VGA_SEQ_D)
-/* attribute registers - slightly strange */
+/* attribute registers - slightly strange, the IS1 read resets the flip-flop */
 #define write_ar(num, val)	do { \
-	vga_io_r(0x3da); write_ind(num, val, VGA_ATT_W, VGA_ATT_W); \
+	u_long _rf; \
+	spin_lock_irqsave(&CHIPS_reglock, _rf); \
+	ct48_regs->r8(VGA_IS1_RC); \
+	write_vga(VGA_ATT_W, (num)); write_vga(VGA_ATT_W, (val)); \
+	spin_unlock_irqrestore(&CHIPS_reglock, _rf); \
 } while (0)
 #define read_ar(num, var)	do { \
-	vga_io_r(0x3da); read_ind(num, var, VGA_ATT_W, VGA_ATT_R); \
+	u_long _rf; \
+	spin_lock_irqsave(&CHIPS_reglock, _rf); \
+	ct48_regs->r8(VGA_IS1_RC); \
+	write_vga(VGA_ATT_W, (num)); read_vga(VGA_ATT_R, var); \
+	spin_unlock_irqrestore(&CHIPS_reglock, _rf); \
+} while (0)
+/* status - a read resets that flip-flop, so not between the two above */
+#define read_is1(var)	do { \
+	u_long _rf; \
+	spin_lock_irqsave(&CHIPS_reglock, _rf); \
+	read_vga(VGA_IS1_RC, var); \
+	spin_unlock_irqrestore(&CHIPS_reglock, _rf); \
 } while (0)
 
 #define N_ELTS(x)	(sizeof(x) / sizeof(x[0]))
@@ -262,20 +743,191 @@ static inline u_long CHIPS_linearbase(void)
     }
 }
 
+/*
+ * Display start in dwords: CR0D, CR0C and bits 1-0 of XR0C. The rest of
+ * XR0C is reserved and the BIOS of PCI boards leaves its own bits there,
+ * so it's read-modify-write, and only when the top bits change.
+ */
+static u_int CHIPS_lasttop = ~0;
+
 static void CHIPS_setdisplaystart(u_long addr)
 {
-    if (pci_mode)
-	return;
+    u_int tmp;
+
     addr >>= 2;
     write_cr(0x0D, (addr & 0x000000FF));
     write_cr(0x0C, (addr & 0x0000FF00)>>8);
-    write_xr(0x0C, (addr & 0x00FF0000)>>16);
+    if (((addr >> 16) & 0x03) != CHIPS_lasttop) {
+	CHIPS_lasttop = (addr >> 16) & 0x03;
+	read_xr(0x0C, tmp);
+	write_xr(0x0C, (tmp & ~0x03) | CHIPS_lasttop);
+    }
+}
+
+/*
+ * Scanlines after 'line' are fetched from the start of VRAM again (split
+ * screen). 11 bits: CR18, CR07 bit 4, CR09 bit 6 and XR16 bit 6;
+ * CT48_LC_OFF is past any mode we do. Only written when it changes.
+ */
+#define CT48_LC_OFF	0x7ff
+
+static u_int CHIPS_lastlc = CT48_LC_OFF;
+
+static void CHIPS_setlinecompare(u_int line)
+{
+    u_int tmp;
+
+    if (line == CHIPS_lastlc)
+	return;
+    CHIPS_lastlc = line;
+
+    write_cr(0x18, line & 0xff);
+    read_cr(0x07, tmp);
+    write_cr(0x07, (tmp & ~0x10) | ((line >> 4) & 0x10));
+    read_cr(0x09, tmp);
+    write_cr(0x09, (tmp & ~0x40) | ((line >> 3) & 0x40));
+    read_xr(0x16, tmp);
+    write_xr(0x16, (tmp & ~0x40) | ((line >> 4) & 0x40));
+}
+
+/*
+ * Vertical retrace, polled - the chip can raise IRQ on it but boards
+ * don't wire it anywhere usable. Waits for the start of the next retrace
+ * (the start address is latched at its beginning), gives up after a
+ * slow frame. That is a busy wait; in process context whoever needs the
+ * CPU gets it between polls, a retrace missed meanwhile costs a frame.
+ */
+#define CT48_VBL_TIMEOUT	40000	/* [us], a 25 Hz frame */
+#define VGA_IS1_VRETRACE	0x08
+
+static u_long CHIPS_vblwaits, CHIPS_vbltimeouts;
+
+/* start of a retrace within us [us] */
+static int CHIPS_vretrace(u_int us)
+{
+    u_int tmp, t;
+
+    /* if we're in it already it is probably too late for this one */
+    for (t = 0; t < us; t += 2) {
+	read_is1(tmp);
+	if (!(tmp & VGA_IS1_VRETRACE))
+	    break;
+	udelay(2);
+    }
+    for (; t < us; t += 2) {
+	read_is1(tmp);
+	if (tmp & VGA_IS1_VRETRACE)
+	    return 0;
+	udelay(2);
+	if (!in_interrupt() && current->need_resched)
+	    schedule();
+    }
+    return -ETIMEDOUT;
+}
+
+static int CHIPS_waitvblank(void)
+{
+    CHIPS_vblwaits++;
+    if (!CHIPS_vretrace(CT48_VBL_TIMEOUT))
+	return 0;
+    CHIPS_vbltimeouts++;
+    return -ETIMEDOUT;
+}
+
+/*
+ * DAC, 6 bits per component. The shadow has what it holds so entries
+ * that don't change aren't written. A write leaves the index on the next
+ * entry: CHIPS_dacnext is where the next data would land, ~0 when the
+ * index has to be set first - only within one cmap load, anybody may
+ * touch the index between calls. CHIPS_daclock is held around DAC
+ * writes, the retrace timer writes it too.
+ */
+static struct {
+    u_char r, g, b, ok;			/* ok: the DAC holds r, g, b */
+} CHIPS_dac[256];
+static u_int CHIPS_dacnext = ~0;
+static spinlock_t CHIPS_daclock = SPIN_LOCK_UNLOCKED;
+static u_long CHIPS_dacwrites, CHIPS_dacskips;
+
+/* palette[] entries waiting for a retrace to go to the DAC */
+static u_int CHIPS_dacfirst = 256, CHIPS_daclast;
+static u_long CHIPS_dacflushes;
+
+static void CHIPS_setdac(u_int regno, u_char r, u_char g, u_char b)
+{
+    if (CHIPS_dac[regno].ok && (CHIPS_dac[regno].r == r) &&
+	(CHIPS_dac[regno].g == g) && (CHIPS_dac[regno].b == b)) {
+	CHIPS_dacskips++;
+	return;
+    }
+    if (regno != CHIPS_dacnext) {
+	write_vga(VGA_PEL_IW, regno);
+	udelay(1);
+    }
+    write_vga(VGA_PEL_D, r);
+    write_vga(VGA_PEL_D, g);
+    write_vga(VGA_PEL_D, b);
+    CHIPS_dacnext = regno + 1;
+    CHIPS_dac[regno].r = r;
+    CHIPS_dac[regno].g = g;
+    CHIPS_dac[regno].b = b;
+    CHIPS_dac[regno].ok = 1;
+    CHIPS_dacwrites++;
+}
+
+/* the DAC lost what it held (the BIOS set a mode), write the palette again */
+static void CHIPS_reloaddac(void)
+{
+    unsigned long flags;
+    u_int n;
+
+    spin_lock_irqsave(&CHIPS_daclock, flags);
+    CHIPS_dacnext = ~0;
+    for (n = 0; n < 256; n++) {
+	CHIPS_dac[n].ok = 0;
+	CHIPS_setdac(n, palette[n].red >> 10, palette[n].green >> 10, palette[n].blue >> 10);
+    }
+    CHIPS_dacnext = ~0;
+    spin_unlock_irqrestore(&CHIPS_daclock, flags);
+}
+
+/* somebody else may have loaded the DAC, the next cmap load writes it all */
+static void CHIPS_forgetdac(void)
+{
+    unsigned long flags;
+    u_int n;
+
+    spin_lock_irqsave(&CHIPS_daclock, flags);
+    for (n = 0; n < 256; n++)
+	CHIPS_dac[n].ok = 0;
+    CHIPS_dacnext = ~0;
+    spin_unlock_irqrestore(&CHIPS_daclock, flags);
+}
+
+/* a retrace just started: out with the queued entries (8bpp, else they're stale) */
+static void CHIPS_flushdac(void)
+{
+    unsigned long flags;
+    u_int n;
+
+    spin_lock_irqsave(&CHIPS_daclock, flags);
+    if ((CHIPS_dacfirst <= CHIPS_daclast) && (bpp == 8)) {
+	CHIPS_dacnext = ~0;
+	for (n = CHIPS_dacfirst; n <= CHIPS_daclast; n++)
+	    CHIPS_setdac(n, palette[n].red >> 10, palette[n].green >> 10, palette[n].blue >> 10);
+	CHIPS_dacnext = ~0;
+	CHIPS_dacflushes++;
+    }
+    CHIPS_dacfirst = 256;
+    CHIPS_daclast = 0;
+    spin_unlock_irqrestore(&CHIPS_daclock, flags);
 }
 
 static inline void CHIPS_cursorinit(struct ct48fb_info *i)
 {
-    outl(i->currentmode.cursor_base, DR0C);	/* set cursor base address */
-    outl(0x00000020, DR08);		/* hidden, 32x32, pop-up thing disabled, */
+    write_dr(DR0C, i->cursor_base);	/* set cursor base address */
+    i->cslot_cur = 0;
+    write_dr(DR08, 0x00000020);		/* hidden, 32x32, pop-up thing disabled, */
 					/* ULC is 0,0 of image, blinking disabled (XR60) */
 }
 
@@ -365,6 +1017,16 @@ static __init u_int CHIPS_memorysize(void)
     return video_memory*1024;
 }
 
+/* a dual drive (dual scan STN) panel in XR51 bits 1-0, frame acceleration on in XR6F bit 1 */
+static __init int CHIPS_dualscan(void)
+{
+    u_int type, accel;
+
+    read_xr(0x51,type);
+    read_xr(0x6F,accel);
+    return ((type & 3) == 3) && (accel & 0x02);
+}
+
 static __init int CHIPS_detectconfiguration(void)
 {
     u_int tmp;
@@ -499,32 +1161,91 @@ static struct chips_init_reg chips_init16_cr[] = {
     { 0x05, 0x1C },
     { 0x07, 0xF0 },
     { 0x11, 0x0C },
-    { 0x12, 0x4F },
+    { 0x12, 0x57 },
     { 0x13, 0xC8 },
 };
 
+/*
+ * The modes above were taken from the BIOS on the Toshiba's 800x600
+ * panel and are used as they are, but for the lines that don't fit in
+ * video memory (800x16bpp on a dual scan panel gets 592). Any other size
+ * gets its CRTC values computed from the timings (CHIPS_crtc()) and is
+ * centered on the panel.
+ */
+#define CT48_PANEL_XRES		800
+#define CT48_PANEL_YRES		600
+#define CT48_MIN_XRES		320
+#define CT48_MIN_YRES		200
+
+static const struct ct48fb_tabmode {
+    int xres, yres;
+    struct ct48fb_timing t;		/* what the 8bpp tables amount to */
+    struct chips_init_reg *xr[2], *cr[2];	/* 8 and 16bpp */
+    int nxr[2], ncr[2];
+} ct48fb_tabmodes[] = {
+    { 640, 480, { 56, 24, 96, 32, 32, 2, FB_SYNC_HOR_HIGH_ACT|FB_SYNC_VERT_HIGH_ACT },
+      { chips_640_init8_xr, chips_640_init16_xr }, { chips_640_init8_cr, chips_640_init16_cr },
+      { N_ELTS(chips_640_init8_xr), N_ELTS(chips_640_init16_xr) },
+      { N_ELTS(chips_640_init8_cr), N_ELTS(chips_640_init16_cr) } },
+    { 800, 600, { 96, 48, 128, 32, 32, 2, 0 },
+      { chips_init8_xr, chips_init16_xr }, { chips_init8_cr, chips_init16_cr },
+      { N_ELTS(chips_init8_xr), N_ELTS(chips_init16_xr) },
+      { N_ELTS(chips_init8_cr), N_ELTS(chips_init16_cr) } },
+};
+#define CT48_TAB_PANEL		1	/* the one that fills the panel */
+
+/* a mode's registers, in the order they are written */
+#define CT48_CRTC_REGS		24
+
+struct ct48fb_crtc {
+    struct chips_init_reg xr[CT48_CRTC_REGS], cr[CT48_CRTC_REGS];
+    int nxr, ncr;
+};
+
+/*
+ * Synthesizer values for the clock closest to clk (kHz):
+ *   Fout = REF * 4 / (N * PSN) * M / 2^P
+ * with REF / (N * PSN) between 150 kHz and 2 MHz and the VCO between 48
+ * and 220 MHz. Fout grows with M, so for every N, PSN and P only the two
+ * M around the target are worth trying (as in ct48mode's modClock.c).
+ * On equal error the smallest M, N, P, PSN win, so this picks exactly what
+ * trying every combination did, in a couple of thousand steps.
+ */
 static void CHIPS_calcmnp(u_int clk, u_char* mm, u_char* nn, u_char* pp, u_char *psn)
 {
-    u_char m, n, p, ps;
-    u_int f;
-    int curr, delta=100000;
+    u_int f, m, n, p, k, i, mlo, mhi, out, curr, key, delta = ~0, best = ~0;
 
     *mm=*nn=*pp=0;
-    for (m=3; m<=127; m++) {
-        for (n=3; n<=127; n++) {
-    	    for (p=0; p<=5; p++) {
-	        for (ps=1; ps<5; ps=ps+3) {
-	    	    f = CT48_REFERENCE_CLOCK*4/(n*ps);
-		    if ((f>=(150*4)) && (f<= (2000*4))) {
-    		        f = f*m;
-		        if ((f>=48000) && (f<=220000)) {
-			    f = f/(1<<p);
-			    curr= clk>f ? clk-f : f-clk;
-			    if (curr<delta) {
-				delta=curr;
-				*mm=m; *nn=n; *pp=p; *psn=ps;
-			    }
-			}
+    *psn=4;
+    for (k = 0; k < 2; k++) {
+	for (n = 3; n <= 127; n++) {
+	    f = CT48_REFERENCE_CLOCK*4/(n*(k ? 4 : 1));
+	    if ((f < 150*4) || (f > 2000*4))
+		continue;
+	    /* M that keep the VCO in range */
+	    mlo = (48000 + f - 1) / f;
+	    mhi = 220000 / f;
+	    if (mlo < 3)
+		mlo = 3;
+	    if (mhi > 127)
+		mhi = 127;
+	    if (mlo > mhi)
+		continue;
+	    for (p = 0; p <= 5; p++) {
+		for (i = 0; i < 2; i++) {
+		    /* just below and just above the target */
+		    m = ((clk << p) / f) + i;
+		    if (m < mlo)
+			m = mlo;
+		    if (m > mhi)
+			m = mhi;
+		    out = (f * m) >> p;
+		    curr = clk > out ? clk - out : out - clk;
+		    key = (m << 16) | (n << 8) | (p << 4) | k;
+		    if ((curr < delta) || ((curr == delta) && (key < best))) {
+			delta = curr;
+			best = key;
+			*mm=m; *nn=n; *pp=p; *psn=k ? 4 : 1;
 		    }
 		}
 	    }
@@ -532,9 +1253,38 @@ static void CHIPS_calcmnp(u_int clk, u_char* mm, u_char* nn, u_char* pp, u_char
     }
 }
 
-static void CHIPS_setclock(u_int pixclock)
+/* synthesizer values of the last few clocks asked for */
+#define CT48_PLL_CACHE	4
+
+static struct {
+    u_int clk;				/* kHz, 0: unused */
+    u_char m, n, p, psn;
+} CHIPS_pll[CT48_PLL_CACHE];
+static u_int CHIPS_pllnext;
+
+static void CHIPS_lookupmnp(u_int clk, u_char* mm, u_char* nn, u_char* pp, u_char *psn)
+{
+    int i;
+
+    for (i = 0; i < CT48_PLL_CACHE; i++)
+	if (CHIPS_pll[i].clk == clk)
+	    break;
+    if (i == CT48_PLL_CACHE) {
+	i = CHIPS_pllnext++ % CT48_PLL_CACHE;
+	CHIPS_pll[i].clk = clk;
+	CHIPS_calcmnp(clk, &CHIPS_pll[i].m, &CHIPS_pll[i].n, &CHIPS_pll[i].p, &CHIPS_pll[i].psn);
+    }
+    *mm = CHIPS_pll[i].m;
+    *nn = CHIPS_pll[i].n;
+    *pp = CHIPS_pll[i].p;
+    *psn = CHIPS_pll[i].psn;
+}
+
+static u_int CHIPS_lastclock;		/* kHz, what XR30-XR32 were set to */
+
+/* force: program it even if it's what was set last (the chip lost it) */
+static void CHIPS_setclock(u_int pixclock, int force)
 {
-    static u_int lastpixclock;
     u_int tmp;
     u_char m, n, p, psn;
     u_int reg30 = 0;
@@ -542,10 +1292,10 @@ static void CHIPS_setclock(u_int pixclock)
     if (pci_mode)
 	return;
 
-    if (lastpixclock != pixclock) {
-	lastpixclock = pixclock;
+    if (force || (CHIPS_lastclock != pixclock)) {
+	CHIPS_lastclock = pixclock;
 
-	CHIPS_calcmnp(pixclock, &m, &n, &p, &psn);
+	CHIPS_lookupmnp(pixclock, &m, &n, &p, &psn);
 	reg30 = p << 1;
 	if (psn == 1)
 	    reg30++;
@@ -559,67 +1309,337 @@ static void CHIPS_setclock(u_int pixclock)
     }
 }
 
-static void CHIPS_8bpp_setmode(int xres)
+/* addr in a register list, 0 if it isn't there */
+static u_char CHIPS_crtc_get(const struct chips_init_reg *r, int n, u_char addr)
 {
     int i;
-    
-    /* rely on lrmi tool to set mode */
-    if (pci_mode)
-	return;
 
-    bpp = 8;
-    if (xres == 800) {
-	for (i = 0; i < N_ELTS(chips_init8_xr); ++i)
-		write_xr(chips_init8_xr[i].addr, chips_init8_xr[i].data);
-	for (i = 0; i < N_ELTS(chips_init8_cr); ++i)
-		write_cr(chips_init8_cr[i].addr, chips_init8_cr[i].data);
-    } else
-    if (xres == 640) {
-	for (i = 0; i < N_ELTS(chips_640_init8_xr); ++i)
-		write_xr(chips_640_init8_xr[i].addr, chips_640_init8_xr[i].data);
-	for (i = 0; i < N_ELTS(chips_640_init8_cr); ++i)
-		write_cr(chips_640_init8_cr[i].addr, chips_640_init8_cr[i].data);
+    for (i = 0; i < n; i++)
+	if (r[i].addr == addr)
+	    return r[i].data;
+    return 0;
+}
+
+/* set addr to val in a register list, appended if it isn't there */
+static void CHIPS_crtc_set(struct chips_init_reg *r, int *n, u_char addr, u_char val)
+{
+    int i;
+
+    for (i = 0; (i < *n) && (r[i].addr != addr); i++)
+	;
+    if (i == *n) {
+	if (*n == CT48_CRTC_REGS)
+	    return;
+	(*n)++;
     }
-};
+    r[i].addr = addr;
+    r[i].data = val;
+}
+
+/*
+ * Registers of mode p at depth bits per pixel (unblank sets 8bpp before
+ * 16bpp). Horizontal values are in character clocks of 8 pixels, twice
+ * as many at 16bpp. ct48fb_decode_var() made sure everything fits.
+ */
+static void CHIPS_crtc(const struct ct48fb_par *p, int depth, struct ct48fb_crtc *c)
+{
+    const struct ct48fb_tabmode *m;
+    const struct ct48fb_timing *t = &p->t;
+    int d = (depth == 16), k = depth / 8;
+    u_int ht, hde, hss, hse, hbe, vt, vde, vss, vse, vbe;
+
+    m = &ct48fb_tabmodes[(p->tab < 0) ? CT48_TAB_PANEL : p->tab];
+    c->nxr = m->nxr[d];
+    c->ncr = m->ncr[d];
+    memcpy(c->xr, m->xr[d], c->nxr * sizeof(c->xr[0]));
+    memcpy(c->cr, m->cr[d], c->ncr * sizeof(c->cr[0]));
+    if (p->tab >= 0) {
+	if (p->yres < m->yres) {
+	    /* short of memory, the display ends early */
+	    CHIPS_crtc_set(c->cr, &c->ncr, 0x07, (CHIPS_crtc_get(c->cr, c->ncr, 0x07) & ~0x42) |
+			   (((p->yres-1) >> 7) & 0x02) | (((p->yres-1) >> 3) & 0x40));
+	    CHIPS_crtc_set(c->cr, &c->ncr, 0x12, p->yres - 1);
+	}
+	return;
+    }
+
+    /* the panel's own registers stay, the CRT side is computed */
+    ht = (t->left + p->xres + t->right + t->hsync) / 8 * k;
+    hde = p->xres / 8 * k;
+    hss = (p->xres + t->right) / 8 * k;
+    hse = hss + t->hsync / 8 * k;
+    hbe = ht - 1;
+    vt = t->upper + p->yres + t->lower + t->vsync;
+    vde = p->yres;
+    vss = p->yres + t->lower;
+    vse = vss + t->vsync;
+    vbe = vt - 1;
+
+    c->ncr = 0;
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x11, vse & 0x0f);	/* unprotects CR00-CR07 */
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x00, ht - 5);
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x01, hde - 1);
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x02, hde);
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x03, 0x80 | (hbe & 0x1f));
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x04, hss);
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x05, ((hbe & 0x20) << 2) | (hse & 0x1f));
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x06, vt - 2);
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x07, (((vt-2) >> 8) & 0x01) | (((vde-1) >> 7) & 0x02) |
+		   ((vss >> 6) & 0x04) | ((vde >> 5) & 0x08) | (((vt-2) >> 4) & 0x20) |
+		   (((vde-1) >> 3) & 0x40) | ((vss >> 2) & 0x80));
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x09, (vde >> 4) & 0x20);
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x10, vss);
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x12, vde - 1);
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x13, p->xres * depth / 64);
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x15, vde);
+    CHIPS_crtc_set(c->cr, &c->ncr, 0x16, vbe);
+
+    CHIPS_crtc_set(c->xr, &c->nxr, 0x17, (((ht-5) >> 8) & 0x01) | (((hde-1) >> 7) & 0x02) |
+		   ((hss >> 6) & 0x04) | ((hse >> 2) & 0x08) | ((hde >> 4) & 0x10) |
+		   ((hbe >> 1) & 0x20));
+    if (d)
+	CHIPS_crtc_set(c->xr, &c->nxr, 0x1E, p->xres * depth / 64);	/* like CR13 */
+    /* smaller than the panel: centered, the alternate sync polarity is ours */
+    CHIPS_crtc_set(c->xr, &c->nxr, 0x55, ((p->xres < CT48_PANEL_XRES) ? 0x03 : 0x31) |
+		   ((t->sync & FB_SYNC_HOR_HIGH_ACT) ? 0 : 0x40) |
+		   ((t->sync & FB_SYNC_VERT_HIGH_ACT) ? 0 : 0x80));
+    if (p->yres < CT48_PANEL_YRES)
+	CHIPS_crtc_set(c->xr, &c->nxr, 0x57, 0x03);
+}
 
-static void CHIPS_16bpp_setmode(int xres)
+static void CHIPS_setmode(const struct ct48fb_par *p, int depth)
 {
+    struct ct48fb_crtc c;
     int i;
 
     /* rely on lrmi tool to set mode */
     if (pci_mode)
 	return;
 
-    bpp = 16;
-    if (xres == 800) {
-	for (i = 0; i < N_ELTS(chips_init16_xr); ++i)
-		write_xr(chips_init16_xr[i].addr, chips_init16_xr[i].data);
-	for (i = 0; i < N_ELTS(chips_init16_cr); ++i)
-		write_cr(chips_init16_cr[i].addr, chips_init16_cr[i].data);
-    } else
-    if (xres == 640) {
-	for (i = 0; i < N_ELTS(chips_640_init16_xr); ++i)
-		write_xr(chips_640_init16_xr[i].addr, chips_640_init16_xr[i].data);
-	for (i = 0; i < N_ELTS(chips_640_init16_cr); ++i)
-		write_cr(chips_640_init16_cr[i].addr, chips_640_init16_cr[i].data);
+    bpp = depth;
+    CHIPS_crtc(p, depth, &c);
+    for (i = 0; i < c.nxr; ++i)
+	write_xr(c.xr[i].addr, c.xr[i].data);
+    for (i = 0; i < c.ncr; ++i)
+	write_cr(c.cr[i].addr, c.cr[i].data);
+}
+
+/*
+ * Register snapshots
+ *
+ * The first time a mode is set it is written from the tables and then
+ * read back into a snapshot. Switching to it again only touches the
+ * registers where it differs from the snapshot the chip holds; unblanking
+ * (the BIOS may have reset the chip meanwhile) reads them all back and
+ * writes what differs - no 8bpp detour, no delays. Bits that aren't the
+ * mode's own (display start, line compare, blanking) are masked out,
+ * their functions put them back.
+ */
+enum { CT48_XR, CT48_CR, CT48_SR, CT48_GR, CT48_AR, CT48_PLL };
+
+static const struct {
+    u_short index, rd, wr;
+} CHIPS_ports[] = {
+    { VGA_XR_I, VGA_XR_D, VGA_XR_D },
+    { VGA_CRT_IC, VGA_CRT_DC, VGA_CRT_DC },
+    { VGA_SEQ_I, VGA_SEQ_D, VGA_SEQ_D },
+    { VGA_GFX_I, VGA_GFX_D, VGA_GFX_D },
+    { VGA_ATT_W, VGA_ATT_R, VGA_ATT_W },
+    { VGA_XR_I, VGA_XR_D, VGA_XR_D },
+};
+
+/* in the order they're restored, protection bits come first */
+static const struct ct48fb_snapreg {
+    u_char group, addr;
+    u_char mask;			/* bits that belong to the mode */
+} ct48fb_snapregs[] = {
+    { CT48_XR, 0x15, 0xff }, { CT48_XR, 0x70, 0xff },
+    /* DR setup and blitter mode */
+    { CT48_XR, 0x07, 0xff }, { CT48_XR, 0x40, 0xff }, { CT48_XR, 0x03, 0xff },
+    { CT48_XR, 0x04, 0xff }, { CT48_XR, 0x0B, 0xff },
+    /* the mode tables, panel included */
+    { CT48_XR, 0x06, 0xff }, { CT48_XR, 0x0C, 0xfc }, { CT48_XR, 0x0F, 0xff },
+    { CT48_XR, 0x16, 0xbf }, { CT48_XR, 0x17, 0xff }, { CT48_XR, 0x19, 0xff },
+    { CT48_XR, 0x1A, 0xff }, { CT48_XR, 0x1B, 0xff }, { CT48_XR, 0x1C, 0xff },
+    { CT48_XR, 0x1E, 0xff }, { CT48_XR, 0x2B, 0xff }, { CT48_XR, 0x55, 0xff },
+    { CT48_XR, 0x57, 0xff }, { CT48_XR, 0x63, 0x80 },
+    { CT48_PLL, 0x30, 0xff }, { CT48_PLL, 0x31, 0xff }, { CT48_PLL, 0x32, 0xff },
+    /* CR11 unprotects CR00-CR07 */
+    { CT48_CR, 0x11, 0xff }, { CT48_CR, 0x00, 0xff }, { CT48_CR, 0x01, 0xff },
+    { CT48_CR, 0x02, 0xff }, { CT48_CR, 0x03, 0xff }, { CT48_CR, 0x04, 0xff },
+    { CT48_CR, 0x05, 0xff }, { CT48_CR, 0x06, 0xff }, { CT48_CR, 0x07, 0xef },
+    { CT48_CR, 0x08, 0xff }, { CT48_CR, 0x09, 0xbf }, { CT48_CR, 0x10, 0xff },
+    { CT48_CR, 0x12, 0xff }, { CT48_CR, 0x13, 0xff }, { CT48_CR, 0x14, 0xff },
+    { CT48_CR, 0x15, 0xff }, { CT48_CR, 0x16, 0xff }, { CT48_CR, 0x17, 0xff },
+    /* SR01 bit 5 is blanking */
+    { CT48_SR, 0x01, 0xdf }, { CT48_SR, 0x02, 0xff }, { CT48_SR, 0x03, 0xff },
+    { CT48_SR, 0x04, 0xff },
+    { CT48_GR, 0x00, 0xff }, { CT48_GR, 0x01, 0xff }, { CT48_GR, 0x02, 0xff },
+    { CT48_GR, 0x03, 0xff }, { CT48_GR, 0x04, 0xff }, { CT48_GR, 0x05, 0xff },
+    { CT48_GR, 0x06, 0xff }, { CT48_GR, 0x07, 0xff }, { CT48_GR, 0x08, 0xff },
+    { CT48_AR, 0x10, 0xff }, { CT48_AR, 0x11, 0xff }, { CT48_AR, 0x12, 0xff },
+    { CT48_AR, 0x13, 0xff }, { CT48_AR, 0x14, 0xff },
+};
+#define CT48_SNAP_REGS		N_ELTS(ct48fb_snapregs)
+#define CT48_SNAPS		4	/* modes remembered */
+
+static struct {
+    struct ct48fb_par par;		/* mode it was taken in, bpp 0: unused */
+    u_int val[CT48_SNAP_REGS];
+} CHIPS_snap[CT48_SNAPS];
+static u_int CHIPS_snapnext;
+static int CHIPS_snapcur = -1;		/* what the chip holds, -1: don't know */
+static u_long CHIPS_restores, CHIPS_restored;	/* restores, registers they wrote */
+
+/* same registers, whatever the panning and acceleration */
+static int CHIPS_samemode(const struct ct48fb_par *a, const struct ct48fb_par *b)
+{
+    return (a->bpp == b->bpp) && (a->xres == b->xres) && (a->yres == b->yres) &&
+	   !memcmp(&a->t, &b->t, sizeof(a->t)) && (a->tab == b->tab) &&
+	   (a->pixclock == b->pixclock) && (a->screen_size == b->screen_size);
+}
+
+/* caller holds CHIPS_reglock; the index stays selected, but for the PLL */
+static u_int CHIPS_snapread(const struct ct48fb_snapreg *r)
+{
+    u_int val, xr33;
+
+    if (r->group == CT48_PLL) {
+	/* the set CHIPS_setclock() programs, with XR33 bit 5 clear */
+	write_vga(VGA_XR_I, 0x33);
+	read_vga(VGA_XR_D, xr33);
+	write_vga(VGA_XR_D, xr33 & ~0x20);
+	write_vga(VGA_XR_I, r->addr);
+	read_vga(VGA_XR_D, val);
+	write_vga(VGA_XR_I, 0x33);
+	write_vga(VGA_XR_D, xr33);
+	return val;
     }
+    if (r->group == CT48_AR)
+	ct48_regs->r8(VGA_IS1_RC);	/* flip-flop to index */
+    write_vga(CHIPS_ports[r->group].index, r->addr);
+    read_vga(CHIPS_ports[r->group].rd, val);
+    return val;
 }
 
-static __init void CHIPS_init(void)
+/* the attribute index was written without the palette bit, screen back on */
+static inline void CHIPS_arend(void)
 {
-    u_int tmp;
+    u_long flags;
 
-    write_xr(0x07, 0xf4);			/* set base for DR registers, start @ 0x83d0 */
-    write_xr(0x03, 0x02);			/* enable 32-bit DR registers */
-    /*
-     * ct48_setmode already set this register,
-     * so don't set to a wrong value
-     *  however: bit #0 must be set to work correctly
-     */
-    if (!pci_mode)
-        write_xr(0x04, 0x24);  
-    read_xr(0x0b, tmp);
-    write_xr(0x0b, tmp | 0x10);			/* enable linear addressing mode */
+    spin_lock_irqsave(&CHIPS_reglock, flags);
+    ct48_regs->r8(VGA_IS1_RC);
+    write_vga(VGA_ATT_W, 0x20);
+    spin_unlock_irqrestore(&CHIPS_reglock, flags);
+}
+
+/* read the registers of the mode that was just set; the BIOS does PCI modes */
+static void CHIPS_snapshot(const struct ct48fb_par *p)
+{
+    u_long flags;
+    int i, n;
+
+    if (pci_mode)
+	return;
+    for (n = 0; (n < CT48_SNAPS) && !CHIPS_samemode(&CHIPS_snap[n].par, p); n++)
+	;
+    if (n == CT48_SNAPS)
+	n = CHIPS_snapnext++ % CT48_SNAPS;
+    CHIPS_snap[n].par = *p;
+    for (i = 0; i < CT48_SNAP_REGS; i++) {
+	spin_lock_irqsave(&CHIPS_reglock, flags);
+	CHIPS_snap[n].val[i] = CHIPS_snapread(&ct48fb_snapregs[i]);
+	spin_unlock_irqrestore(&CHIPS_reglock, flags);
+    }
+    CHIPS_arend();
+    CHIPS_snapcur = n;
+}
+
+/*
+ * Put mode p back from its snapshot: registers written, -1 if there is
+ * no snapshot. trust: the chip still holds the last mode set, only
+ * registers that differ between the two are looked at.
+ */
+static int CHIPS_restore(const struct ct48fb_par *p, int trust)
+{
+    const struct ct48fb_snapreg *r;
+    u_int *snap, *from = NULL, cur, val, mask, tmp;
+    int i, n, pll = 0, seq = 0, ar = 0, written = 0;
+    u_long flags;
+
+    if (pci_mode)
+	return -1;
+    for (n = 0; (n < CT48_SNAPS) && !CHIPS_samemode(&CHIPS_snap[n].par, p); n++)
+	;
+    if (n == CT48_SNAPS)
+	return -1;
+    snap = CHIPS_snap[n].val;
+    if (trust && (CHIPS_snapcur >= 0))
+	from = CHIPS_snap[CHIPS_snapcur].val;
+
+    CHIPS_restores++;
+    for (i = 0; i < CT48_SNAP_REGS; i++) {
+	r = &ct48fb_snapregs[i];
+	mask = r->mask;
+	if (from && !((from[i] ^ snap[i]) & mask))
+	    continue;
+	ar |= (r->group == CT48_AR);
+	spin_lock_irqsave(&CHIPS_reglock, flags);
+	cur = CHIPS_snapread(r);
+	val = (cur & ~mask) | (snap[i] & mask);
+	if ((val != cur) && (r->group != CT48_PLL) && (r->group != CT48_SR))
+	    write_vga(CHIPS_ports[r->group].wr, val);	/* index is still selected */
+	spin_unlock_irqrestore(&CHIPS_reglock, flags);
+	if (val == cur)
+	    continue;
+	written++;
+	switch (r->group) {
+	    case CT48_PLL:		/* all three at once, below */
+		pll = 1;
+		break;
+	    case CT48_SR:		/* the sequencer is held in reset meanwhile */
+		if (!seq) {
+		    seq = 1;
+		    write_sr(0x00, 0x01);
+		}
+		write_sr(r->addr, val);
+		break;
+	}
+    }
+    if (ar)
+	CHIPS_arend();
+    if (seq)
+	write_sr(0x00, 0x03);
+    if (pll) {
+	read_xr(0x33, tmp);
+	write_xr(0x33, tmp & ~0x20);
+	for (i = 0; i < CT48_SNAP_REGS; i++)
+	    if (ct48fb_snapregs[i].group == CT48_PLL)
+		write_xr(ct48fb_snapregs[i].addr, snap[i]);
+	write_xr(0x33, tmp);
+    }
+    CHIPS_lastclock = p->pixclock;
+    CHIPS_snapcur = n;
+    CHIPS_restored += written;
+    bpp = p->bpp;
+    return written;
+}
+
+static __init void CHIPS_init(void)
+{
+    u_int tmp;
+
+    write_xr(0x07, 0xf4);			/* set base for DR registers, start @ 0x83d0 */
+    write_xr(0x03, 0x02);			/* enable 32-bit DR registers */
+    /*
+     * ct48_setmode already set this register,
+     * so don't set to a wrong value
+     *  however: bit #0 must be set to work correctly
+     */
+    if (!pci_mode)
+        write_xr(0x04, 0x24);  
+    read_xr(0x0b, tmp);
+    write_xr(0x0b, tmp | 0x10);			/* enable linear addressing mode */
     write_xr(0x15, 0x00);			/* unprotect everything */
     write_xr(0x55, 0xF1);
     read_xr(0x72, tmp);
@@ -638,6 +1658,17 @@ static __init void CHIPS_init(void)
 
 /* ------------------- acceleration engine functions prototypes ------------ */
 
+static void ct48fb_blt_init(void);
+static void ct48fb_blt_sync(void);
+static void ct48fb_blt_wait(void);
+static void ct48fb_blt_queue(struct ct48fb_blt_cmd *c);
+static void ct48fb_blt_forget(void);
+static void ct48fb_own_get(int who);
+static void ct48fb_own_put(void);
+static int ct48fb_own_try(int who);
+#ifdef CONFIG_PROC_FS
+static int ct48fb_read_proc(char *page, char **start, off_t off, int count, int *eof, void *data);
+#endif
 static void ct48fb_acc_setup(struct display *p);
 static void ct48fb_acc_bmove(struct display *p, int sy, int sx, int dy, int dx, int height, int width);
 static void ct48fb_acc_clear(struct vc_data *conp, struct display *p, int sy, int sx, int h, int w);
@@ -648,6 +1679,8 @@ static void ct48fb_acc_clear_margins(struct vc_data *conp, struct display *p, in
 static void ct48fb_acc_cursor(struct display* p, int mode, int x, int y);
 static int  ct48fb_acc_set_font(struct display* p, int w, int h);
 static void ct48fb_set_cursor_shape(struct ct48fb_info *p);
+static void ct48fb_cursor_forget(struct ct48fb_info *p);
+static void ct48fb_cursor_console(struct ct48fb_info *p);
 
 static struct display_switch ct48fb_accel = {
     setup:		ct48fb_acc_setup,
@@ -662,9 +1695,113 @@ static struct display_switch ct48fb_accel = {
     fontwidthmask:	FONTWIDTH(4)|FONTWIDTH(8)|FONTWIDTH(12)|FONTWIDTH(16)
 };
 
+/* ------------------- offscreen VRAM -------------------------------------- */
+
+/* first fit, align has to be a power of 2 */
+static u_long ct48fb_vram_alloc(u_long size, u_long align, const char *what, struct file *file)
+{
+    struct ct48fb_vram *v = &fb_info.vram;
+    u_long addr;
+    int n;
+
+    if (!size || (size > v->end) || (align > v->end) || (v->count == CT48_VRAM_BLOCKS))
+	return CT48_VRAM_NONE;
+    addr = (v->start + align - 1) & ~(align - 1);
+    for (n = 0; n < v->count; n++) {
+	if (addr + size <= v->blk[n].base)
+	    break;
+	addr = (v->blk[n].base + v->blk[n].size + align - 1) & ~(align - 1);
+    }
+    if (addr + size > v->end)
+	return CT48_VRAM_NONE;
+
+    memmove(&v->blk[n+1], &v->blk[n], (v->count - n) * sizeof(v->blk[0]));
+    v->blk[n].base = addr;
+    v->blk[n].size = size;
+    v->blk[n].what = what;
+    v->blk[n].file = file;
+    v->blk[n].pid = file ? current->pid : 0;
+    v->count++;
+    return addr;
+}
+
+/* file has to match, NULL frees driver blocks; returns 0 if there was no such block */
+static int ct48fb_vram_put(u_long base, struct file *file)
+{
+    struct ct48fb_vram *v = &fb_info.vram;
+    int n;
+
+    for (n = 0; n < v->count; n++) {
+	if ((v->blk[n].base == base) && (v->blk[n].file == file)) {
+	    v->count--;
+	    memmove(&v->blk[n], &v->blk[n+1], (v->count - n) * sizeof(v->blk[0]));
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+static inline void ct48fb_vram_free(u_long base)
+{
+    ct48fb_vram_put(base, NULL);
+}
+
+/* blocks of file */
+static int ct48fb_vram_count(struct file *file)
+{
+    struct ct48fb_vram *v = &fb_info.vram;
+    int n, count = 0;
+
+    for (n = 0; n < v->count; n++)
+	if (v->blk[n].file == file)
+	    count++;
+    return count;
+}
+
+/* is [start, end) the virtual screen or inside one of file's blocks */
+static int ct48fb_vram_mine(struct file *file, u_long start, u_long end)
+{
+    struct ct48fb_vram *v = &fb_info.vram;
+    int n;
+
+    if (end <= v->start)
+	return 1;
+    for (n = 0; n < v->count; n++)
+	if (v->blk[n].file && (v->blk[n].file == file) &&
+	    (start >= v->blk[n].base) && (end <= v->blk[n].base + v->blk[n].size))
+	    return 1;
+    return 0;
+}
+
+/* everything left behind by files that are closed now */
+static void ct48fb_vram_drop(void)
+{
+    struct ct48fb_vram *v = &fb_info.vram;
+    int n;
+
+    for (n = v->count - 1; n >= 0; n--)
+	if (v->blk[n].file && !file_count(v->blk[n].file))
+	    ct48fb_vram_put(v->blk[n].base, v->blk[n].file);
+}
+
+/* new mode, virtual screen ends at start - the fixed blocks go first */
+static void ct48fb_vram_reset(u_long start)
+{
+    fb_info.vram.start = start;
+    fb_info.vram.count = 0;
+    /* decode_var kept CT48_VRAM_FIXED free, these can't fail */
+    fb_info.cursor_base = ct48fb_vram_alloc(CT48_CURSOR_SLOTS * CT48_CURSOR_SIZE, CT48_CURSOR_SIZE, "cursor", NULL);
+    ct48fb_cursor_forget(&fb_info);
+    fb_info.pattern_base = ct48fb_vram_alloc(CT48_PATTERN_SIZE, CT48_PATTERN_SIZE, "pattern", NULL);
+}
+
 /* ------------------- generic framebuffer functions ----------------------- */
 
 #ifdef USE_OWN_FBGEN
+/* whole colormaps go to the DAC in runs */
+static int ct48fb_load_cmap(struct fb_cmap *cmap, int kspc, struct fb_info_gen *info);
+#define fbgen_load_cmap		ct48fb_load_cmap
+
 /* include our generic FB functions */
 #include "ct-fbgen.h"
 #endif
@@ -685,15 +1822,16 @@ static int ct48fb_encode_fix(struct fb_fix_screeninfo *fix, const void *par, str
     strcpy(fix->id, ct48fb_name);
 
     fix->smem_start = i->fbmem;
-    fix->smem_len = i->memsize - 96000 - 1024;
+    fix->smem_len = i->vram.end;		/* offscreen buffers are mmap'd too */
 
     fix->visual = p->bpp==8 ? FB_VISUAL_PSEUDOCOLOR:FB_VISUAL_TRUECOLOR;
 
     fix->type = FB_TYPE_PACKED_PIXELS;
     fix->type_aux = 0;
     fix->xpanstep = 0;
-    fix->ypanstep = 1;
-    fix->ywrapstep = 0;
+    /* fbcon pans when it may and there is room below the screen */
+    fix->ypanstep = (noypan && noywrap) ? 0 : 1;
+    fix->ywrapstep = noywrap ? 0 : 1;
     fix->line_length = p->linelength;
 
     if (!noaccel)
@@ -704,6 +1842,99 @@ static int ct48fb_encode_fix(struct fb_fix_screeninfo *fix, const void *par, str
     return 0;
 }
 
+/* how many lines the virtual screen gets, at least yres */
+static int ct48fb_yres_virtual(struct ct48fb_info *i, int xres_virtual, int bpp, int yres)
+{
+    int lines = (i->vram.end - CT48_VRAM_RESERVE) / (xres_virtual * (bpp/8));
+
+    if (!noywrap)
+	lines = (lines / 16) * 16;	/* fbcon wraps only if the font height divides it */
+    else if (noypan)
+	lines = yres;
+    else
+	lines = (lines / 8) * 8;
+    /* too big to pan, without room for the glyph cache either */
+    return (lines < yres) ? yres : lines;
+}
+
+/* the height of table mode n at depth d, what fits of it */
+static int ct48fb_tab_yres(struct ct48fb_info *i, int n, int d)
+{
+    const struct ct48fb_tabmode *m = &ct48fb_tabmodes[n];
+    int lines = ((i->vram.end - CT48_VRAM_FIXED) / (m->xres * (d ? 2 : 1))) & ~7;
+
+    return (lines < m->yres) ? lines : m->yres;
+}
+
+/*
+ * Size and timings for p. 640 and 800 wide are the table modes, with the
+ * height that goes with them (so "fbset -xres 800" still does what it
+ * always did), and keep the tables' timings. Any other size up to the
+ * panel gets its registers computed from the timings asked for, or from
+ * defaults if there are none.
+ */
+static int ct48fb_decode_timing(struct ct48fb_info *i, struct fb_var_screeninfo *var, struct ct48fb_par *p)
+{
+    struct ct48fb_timing *t = &p->t;
+    u_int k = p->bpp / 8, ht, vt;
+    int d = (p->bpp == 16), n;
+
+    var->xres = (var->xres + 7) & ~7;
+    p->tab = -1;
+    for (n = 0; n < N_ELTS(ct48fb_tabmodes); n++)
+	if (var->xres == ct48fb_tabmodes[n].xres)
+	    p->tab = n;
+    if (p->tab >= 0) {
+	/* the height of another table mode or depth is left over from it */
+	for (n = 0; n < N_ELTS(ct48fb_tabmodes); n++)
+	    if ((var->yres == ct48fb_tab_yres(i, n, 0)) || (var->yres == ct48fb_tab_yres(i, n, 1)))
+		var->yres = ct48fb_tab_yres(i, p->tab, d);
+	if (var->yres != ct48fb_tab_yres(i, p->tab, d))
+	    p->tab = -1;
+    }
+
+    if ((var->xres < CT48_MIN_XRES) || (var->xres > CT48_PANEL_XRES) ||
+	(var->yres < CT48_MIN_YRES) || (var->yres > CT48_PANEL_YRES))
+	return -EINVAL;
+    p->xres = var->xres;
+    p->yres = var->yres;
+
+    if (p->tab >= 0) {
+	*t = ct48fb_tabmodes[p->tab].t;
+	return 0;
+    }
+    /* the BIOS sets the mode on PCI boards, it knows only its own */
+    if (pci_mode)
+	return -EINVAL;
+
+    if (!var->left_margin && !var->right_margin && !var->hsync_len &&
+	!var->upper_margin && !var->lower_margin && !var->vsync_len) {
+	/* about the blanking of the table modes */
+	var->left_margin = var->xres / 10;
+	var->right_margin = var->xres / 32;
+	var->hsync_len = var->xres / 8;
+	var->upper_margin = var->yres / 16;
+	var->lower_margin = var->yres / 64 + 1;
+	var->vsync_len = 2;
+    }
+    /* whole character clocks */
+    t->left = (var->left_margin + 7) & ~7;
+    t->right = (var->right_margin + 7) & ~7;
+    t->hsync = var->hsync_len ? (var->hsync_len + 7) & ~7 : 8;
+    t->upper = var->upper_margin;
+    t->lower = var->lower_margin;
+    t->vsync = var->vsync_len ? var->vsync_len : 1;
+    t->sync = var->sync & (FB_SYNC_HOR_HIGH_ACT|FB_SYNC_VERT_HIGH_ACT);
+
+    /* what the counters can take, see CHIPS_crtc() */
+    ht = (t->left + p->xres + t->right + t->hsync) / 8 * k;
+    vt = t->upper + p->yres + t->lower + t->vsync;
+    if ((ht - 5 > 0x1ff) || (t->hsync / 8 * k > 63) || (ht - 1 - p->xres / 8 * k > 127) ||
+	(t->vsync > 15) || (vt - 2 > 0x3ff) || (vt - 1 - p->yres > 255))
+	return -EINVAL;
+    return 0;
+}
+
 static int ct48fb_decode_var(const struct fb_var_screeninfo *var, void *par, struct fb_info_gen *info)
 {
     struct ct48fb_info * i = (struct ct48fb_info *)info;
@@ -731,45 +1962,27 @@ static int ct48fb_decode_var(const struct fb_var_screeninfo *var, void *par, str
     else
 	p.bpp = 16;
 
-    p.linelength = var->xres_virtual * p.bpp/8;
-
     /* this is to make gcc quiet - I know what I'm doing */
     pvar = (struct fb_var_screeninfo*)var;
-    pvar->yres_virtual = (((i->memsize - 96000 - 1024)/(var->xres_virtual*(var->bits_per_pixel/8)))/8)*8;
 
-    switch (var->xres) {
-	case 640:
-	    pvar->yres = 480;
-	break;
-	case 800:
-	    /* with 16bpp up to 800x592 can be done */
-	    if (var->bits_per_pixel == 16)
-		pvar->yres = 592;
-	    else
-		pvar->yres = 600;
-	break;
-	default:
-	    return -EINVAL;
-	break;
-    }
+    if (ct48fb_decode_timing(i, pvar, &p))
+	return -EINVAL;
 
-    /* finally read xres/yres */
-    i->xres = var->xres; i->yres = var->yres;
+    /* the accelerated paths take the line length from xres */
+    pvar->xres_virtual = var->xres;
+    p.linelength = var->xres_virtual * p.bpp/8;
+    pvar->yres_virtual = ct48fb_yres_virtual(i, var->xres_virtual, p.bpp, var->yres);
 
-    if ((p.linelength * var->yres_virtual) > (i->memsize-96000-1024))
+    if ((p.linelength * var->yres_virtual) > (i->vram.end - CT48_VRAM_FIXED))
 	return -EINVAL;
 
-    p.cursor_base = p.linelength * var->yres_virtual;
+    p.screen_size = p.linelength * var->yres_virtual;
 
     p.pixclock = PICOS2KHZ(var->pixclock);
     if ((p.pixclock < 5000)||(p.pixclock> 220000))
 	p.pixclock = 40000;
 
     p.base = p.linelength * var->yoffset;
-#ifdef FBIFIX
-    CHIPS_setdisplaystart(p.base); /// XXX fbi fucks offset without it
-#endif
-
     p.accel = var->accel_flags;
 
     *((struct ct48fb_par* )par)=p;
@@ -791,14 +2004,12 @@ static int ct48fb_encode_var(struct fb_var_screeninfo *var, const void *par, str
     v.bits_per_pixel = p->bpp;
     v.grayscale = 0;
 
-    v.xres = i->xres;
-    v.xres_virtual = i->xres;
-    v.yres = i->yres;
-    if ((v.bits_per_pixel == 16) && (v.yres == 600))
-	v.yres = 592;
+    v.xres = p->xres;
+    v.xres_virtual = p->xres;
+    v.yres = p->yres;
     v.xoffset = 0;
     v.yoffset = p->base / p->linelength;
-    v.yres_virtual = (((i->memsize - 96000 - 1024)/(v.xres_virtual*(v.bits_per_pixel/8)))/8)*8;
+    v.yres_virtual = ct48fb_yres_virtual(i, v.xres_virtual, v.bits_per_pixel, v.yres);
 
     v.transp.offset = 0;
     v.transp.length = 0;
@@ -826,14 +2037,13 @@ static int ct48fb_encode_var(struct fb_var_screeninfo *var, const void *par, str
 
     v.accel_flags = p->accel;
 
-    /* put some misc shit to make fbset output sane values */
     v.nonstd = 0;
     v.height = -1; v.width = -1;
     v.pixclock = KHZ2PICOS(p->pixclock);
-    v.left_margin = 64; v.right_margin = 64;
-    v.upper_margin = 32; v.lower_margin = 32;
-    v.hsync_len = 64; v.vsync_len = 2;
-    v.sync = 0; v.vmode = FB_VMODE_NONINTERLACED;
+    v.left_margin = p->t.left; v.right_margin = p->t.right;
+    v.upper_margin = p->t.upper; v.lower_margin = p->t.lower;
+    v.hsync_len = p->t.hsync; v.vsync_len = p->t.vsync;
+    v.sync = p->t.sync; v.vmode = FB_VMODE_NONINTERLACED;
 
     *var = v;
 
@@ -852,51 +2062,196 @@ static int ct48fb_pan_display(const struct fb_var_screeninfo *var, struct fb_inf
 {
     u_long offset;
     struct ct48fb_info * i = (struct ct48fb_info *)info;
+    struct ct48fb_blt_cmd cmd;
+    u_int lc, vlines;
 
-    offset = (var->xoffset + (var->yoffset * var->xres)) * var->bits_per_pixel/8;
+    offset = (var->xoffset + (var->yoffset * var->xres_virtual)) * var->bits_per_pixel/8;
     i->currentmode.base = offset;
-    CHIPS_setdisplaystart(offset);
+    /* wrapped: the part of the screen below the end of the buffer comes from its top */
+    vlines = i->currentmode.screen_size / i->currentmode.linelength;
+    lc = CT48_LC_OFF;
+    if ((var->vmode & FB_VMODE_YWRAP) && (var->yoffset + i->yres > vlines))
+	lc = vlines - var->yoffset - 1;
+    /* fbcon pans from printk too, the engine may not be had then */
+    if (var->activate & FB_ACTIVATE_VBL) {
+	/*
+	 * page flip: everything drawn must be there, the new start is
+	 * latched at the next retrace - return once it has been
+	 */
+	if (!ct48fb_own_try(CT48_OWN_DRIVER))
+	    return -EBUSY;
+	ct48fb_blt_sync();
+	CHIPS_setdisplaystart(offset);
+	CHIPS_setlinecompare(lc);
+	ct48fb_own_put();
+	CHIPS_waitvblank();
+	CHIPS_flushdac();		/* queued palette goes with the flip */
+	return 0;
+    }
+
+    if (!ct48fb_own_try(CT48_OWN_DRIVER))
+	return -EBUSY;
+    if (noaccel) {
+	CHIPS_setdisplaystart(offset);
+	CHIPS_setlinecompare(lc);
+    } else {
+	/* behind the blits already queued, no need to wait for them here */
+	cmd.flags = CT48_BLT_START;
+	cmd.dst = offset;
+	cmd.src = lc;
+	ct48fb_blt_queue(&cmd);
+    }
+    ct48fb_own_put();
 
     return 0;
 }
 
-static void ct48fb_set_par(const void *par, struct fb_info_gen *info)
+/* what set_par has to redo when going from mode a to b */
+#define CT48_SET_TIMING		0x01	/* CRTC and panel registers */
+#define CT48_SET_DEPTH		0x02	/* ...blitter mode too */
+#define CT48_SET_CLOCK		0x04
+#define CT48_SET_START		0x08	/* display start */
+#define CT48_SET_VRAM		0x10	/* offscreen blocks move, the cursor image with them */
+#define CT48_SET_ACCEL		0x20
+#define CT48_SET_MODE		(CT48_SET_TIMING | CT48_SET_DEPTH | CT48_SET_CLOCK)
+
+static int ct48fb_par_changes(const struct ct48fb_par *a, const struct ct48fb_par *b)
 {
-    struct ct48fb_info * i = (struct ct48fb_info *)info;
-    struct ct48fb_par * p = (struct ct48fb_par *)par;
-    /*
-     *  Set the hardware according to 'par'.
-     */
+    int changed = 0;
+
+    if (!a->bpp)			/* nothing set yet */
+	return ~0;
+    if ((a->xres != b->xres) || (a->yres != b->yres) || (a->tab != b->tab) ||
+	memcmp(&a->t, &b->t, sizeof(a->t)))
+	changed |= CT48_SET_TIMING;
+    if (a->bpp != b->bpp)
+	changed |= CT48_SET_DEPTH;
+    if (a->pixclock != b->pixclock)
+	changed |= CT48_SET_CLOCK;
+    if (a->base != b->base)
+	changed |= CT48_SET_START;
+    if ((a->screen_size != b->screen_size) || (a->linelength != b->linelength))
+	changed |= CT48_SET_VRAM;
+    if (a->accel != b->accel)
+	changed |= CT48_SET_ACCEL;
+    return changed;
+}
 
-    /* setup for 16bpp/8bpp mode and blitter mode */
-    switch (p->bpp) {
-	case 8:
-	    CHIPS_8bpp_setmode(i->xres);
-	break;
-	case 16:
-	    CHIPS_16bpp_setmode(i->xres);
-	break;
+/*
+ * Set the hardware according to p, only the parts that change - unless
+ * reread says X, svgalib or the BIOS may have been at the chip, then the
+ * mode registers are all read back. Caller owns the engine.
+ */
+static void ct48fb_program_par(struct ct48fb_info *i, const struct ct48fb_par *p)
+{
+    int changed, first = 0, trust = !i->reread, written;
+
+    changed = ct48fb_par_changes(&i->currentmode, p);
+    if (!trust)
+	changed |= CT48_SET_MODE | CT48_SET_START;
+    i->reread = 0;
+    if (!changed)
+	return;
+
+    ct48fb_blt_sync();
+
+    if (changed & (CT48_SET_MODE | CT48_SET_VRAM)) {
+	/* blitter mode is about to change */
+	ct48fb_blt_forget();
+	/* setup for 16bpp/8bpp mode and blitter mode, the long way the first time */
+	written = CHIPS_restore(p, trust);
+	first = written < 0;
+	if (first) {
+	    CHIPS_setmode(p, p->bpp);
+	    CHIPS_setclock(p->pixclock, !trust);
+	}
+	if (!trust && written) {
+	    /* somebody else had a mode, and likely the memory behind the screen */
+	    i->glyphs.font = NULL;
+	    i->pattern_ok = 0;
+	    ct48fb_cursor_forget(i);
+	    i->cslot_cur = -1;
+	    if (!nohwcursor)
+		ct48fb_set_cursor_shape(i);
+	}
+	i->xres = p->xres;
+	i->yres = p->yres;
+	CHIPS_lasttop = ~0;
+	CHIPS_lastlc = ~0;		/* the mode registers include CR07 */
+    }
+    if (changed & (CT48_SET_MODE | CT48_SET_VRAM | CT48_SET_START)) {
+	CHIPS_setdisplaystart(p->base);
+	CHIPS_setlinecompare(CT48_LC_OFF);
     }
-    CHIPS_setclock(p->pixclock);
-    CHIPS_setdisplaystart(p->base);
 
-    if ((p->accel & FB_ACCELF_TEXT)==0) {
+    if ((changed & CT48_SET_ACCEL) && ((p->accel & FB_ACCELF_TEXT)==0)) {
 	/* turn off the cursor */
 	nohwcursor = 1;
 	ct48fb_accel.cursor = NULL;
 	ct48fb_accel.set_font = NULL;
 	if ((fb_info.chipset == CT_548)||(fb_info.chipset == CT_545))
-	    outl(0x00000000, DR08);
+	    write_dr(DR08, 0x00000000);
 	/* there's no "else" with turning the cursor back on as once it is disabled,
 	   software cursor kicks in and I don't know how to disable it */
     }
 
     i->currentmode = *p;
+    if (changed & (CT48_SET_DEPTH | CT48_SET_VRAM)) {
+	ct48fb_vram_reset(p->screen_size);
+	i->glyphs.font = NULL;		/* its block is gone */
+	i->glyphs.ok = 0;
+	i->pattern_ok = 0;
+
+	if (!nohwcursor) {
+	    CHIPS_cursorinit(i);
+	    ct48fb_set_cursor_shape(i);
+	}
+    }
+    if (first)
+	CHIPS_snapshot(p);
+}
 
-    if (!nohwcursor) {
-	CHIPS_cursorinit(i);
-	ct48fb_set_cursor_shape(i);
+static void ct48fb_set_par(const void *par, struct fb_info_gen *info)
+{
+    struct ct48fb_info * i = (struct ct48fb_info *)info;
+
+    ct48fb_own_get(CT48_OWN_DRIVER);
+    if (i->own.lease) {
+	/* a program drives the engine, the mode follows when it's done */
+	i->deferred_par = *(struct ct48fb_par *)par;
+	i->deferred |= CT48_DEFER_PAR;
+    } else
+	ct48fb_program_par(i, (struct ct48fb_par *)par);
+    ct48fb_own_put();
+}
+
+/* another console, maybe back from X: what the chip has is anybody's guess */
+static int ct48fb_switch_con(int con, struct fb_info *info)
+{
+    struct ct48fb_info *i = (struct ct48fb_info *)info;
+    int err, was;
+
+    i->reread = 1;
+    CHIPS_forgetdac();			/* fbgen_switch() loads the whole cmap */
+    was = ct48fb_cursor_user(i);
+    i->con = con;
+    err = fbgen_switch(con, info);
+
+    /* a program's pointer stays with its console */
+    if (i->cursor.user && !nohwcursor) {
+	ct48fb_own_get(CT48_OWN_CURSOR);
+	if (i->own.lease) {
+	    i->deferred |= CT48_DEFER_CURSOR;	/* hands off the chip meanwhile */
+	} else {
+	    ct48fb_blt_wait();
+	    if (ct48fb_cursor_user(i))
+		ct48fb_set_cursor_shape(i);
+	    else if (was)
+		ct48fb_cursor_console(i);
+	}
+	ct48fb_own_put();
     }
+    return err;
 }
 
 static int ct48fb_getcolreg(unsigned regno, unsigned *red, unsigned *green,
@@ -915,7 +2270,8 @@ static int ct48fb_getcolreg(unsigned regno, unsigned *red, unsigned *green,
     return 0;
 }
 
-static int ct48fb_setcolreg(unsigned regno, unsigned red, unsigned green,
+/* one entry, a DAC write continues the run CHIPS_dacnext points at */
+static int ct48fb_setcol(unsigned regno, unsigned red, unsigned green,
 			 unsigned blue, unsigned transp, struct fb_info *info)
 {
     struct ct48fb_info * i = (struct ct48fb_info *)info;
@@ -931,11 +2287,7 @@ static int ct48fb_setcolreg(unsigned regno, unsigned red, unsigned green,
     palette[regno].transp = transp;
 
     if (bpp==8) {
-    	vga_io_w(VGA_PEL_IW, regno);
-    	udelay(1);
-    	vga_io_w(VGA_PEL_D, red>>10);
-    	vga_io_w(VGA_PEL_D, green>>10);
-    	vga_io_w(VGA_PEL_D, blue>>10);
+	CHIPS_setdac(regno, red>>10, green>>10, blue>>10);
     } else {
 	((u16*)info->pseudo_palette)[regno] = (red & 0xF800) | ((green & 0xFC00) >> 5) | ((blue & 0xF800) >> 11);
     }
@@ -943,32 +2295,132 @@ static int ct48fb_setcolreg(unsigned regno, unsigned red, unsigned green,
     return 0;
 }
 
+static int ct48fb_setcolreg(unsigned regno, unsigned red, unsigned green,
+			 unsigned blue, unsigned transp, struct fb_info *info)
+{
+    unsigned long flags;
+    int err;
+
+    spin_lock_irqsave(&CHIPS_daclock, flags);
+    CHIPS_dacnext = ~0;
+    err = ct48fb_setcol(regno, red, green, blue, transp, info);
+    spin_unlock_irqrestore(&CHIPS_daclock, flags);
+    return err;
+}
+
+#ifdef USE_OWN_FBGEN
+/*
+ * fb_set_cmap() with one setcolreg() per entry sets the DAC index and
+ * waits for every colour. Here entries the DAC already has are skipped
+ * and the others go out in runs on the index auto-increment.
+ */
+static int ct48fb_load_cmap(struct fb_cmap *cmap, int kspc, struct fb_info_gen *info)
+{
+    u16 red, green, blue, transp = 0;
+    unsigned long flags;
+    u_int n;
+    int err = 0, stop;
+
+    CHIPS_dacnext = ~0;
+    for (n = 0; n < cmap->len; n++) {
+	if (kspc) {
+	    red = cmap->red[n];
+	    green = cmap->green[n];
+	    blue = cmap->blue[n];
+	    if (cmap->transp)
+		transp = cmap->transp[n];
+	} else if (get_user(red, cmap->red + n) || get_user(green, cmap->green + n) ||
+		   get_user(blue, cmap->blue + n) ||
+		   (cmap->transp && get_user(transp, cmap->transp + n))) {
+	    err = -EFAULT;
+	    break;
+	}
+	/* get_user() may sleep, the lock is taken per entry */
+	spin_lock_irqsave(&CHIPS_daclock, flags);
+	stop = ct48fb_setcol(cmap->start + n, red, green, blue, transp, &info->info);
+	spin_unlock_irqrestore(&CHIPS_daclock, flags);
+	if (stop)
+	    break;
+    }
+    CHIPS_dacnext = ~0;
+    return err;
+}
+#endif
+
+/* after unblanking the BIOS may have set up its own mode meanwhile; caller owns the engine */
+static void ct48fb_restore_mode(struct ct48fb_info *i)
+{
+    int tmp;
+
+    tmp = i->panel_up ? -1 : CHIPS_restore(&i->currentmode, 0);
+    i->panel_up = 0;
+    if (tmp < 0) {
+	/* for proper reinitialization the panel wants to see 8bpp first */
+	CHIPS_snapcur = -1;
+	CHIPS_setmode(&i->currentmode, 8);
+	if (i->currentmode.bpp == 16) {
+	    udelay(500);
+	    CHIPS_setmode(&i->currentmode, 16);
+	}
+	CHIPS_setclock(i->currentmode.pixclock, 1);
+	if (!nohwcursor)
+	    CHIPS_cursorinit(i);
+    }
+    if (tmp && (i->currentmode.bpp == 8))
+	CHIPS_reloaddac();	/* the BIOS' mode came with its palette */
+    if (tmp && !nohwcursor) {
+	/* ...and may have used the cursor or its memory */
+	ct48fb_cursor_forget(i);
+	i->cslot_cur = -1;
+	ct48fb_set_cursor_shape(i);
+    }
+    ct48fb_blt_forget();
+    CHIPS_lasttop = ~0;
+    CHIPS_setdisplaystart(i->currentmode.base);
+    tmp = CHIPS_lastlc;
+    CHIPS_lastlc = ~0;
+    CHIPS_setlinecompare(tmp);
+}
+
+static void ct48fb_unblank_restore(void *data)
+{
+    struct ct48fb_info * i = (struct ct48fb_info *)data;
+
+    ct48fb_own_get(CT48_OWN_DRIVER);
+    if (i->own.lease)
+	i->deferred |= CT48_DEFER_RESTORE;	/* once the program is done */
+    else
+	ct48fb_restore_mode(i);
+    ct48fb_own_put();
+}
+
 static int ct48fb_blank(int blank, struct fb_info_gen *info)
 {
     /* 0 unblank, 1 blank, 2 no vsync, 3 no hsync, 4 off */
     int vgablank=0, tmp;
     struct ct48fb_info * i = (struct ct48fb_info *)info;
 
+    /* the console blank timer and the keyboard call this in interrupt context */
+    if (ct48fb_own_try(CT48_OWN_DRIVER)) {
+	ct48fb_blt_sync();
+	ct48fb_own_put();
+    }
+
     switch (blank) {
 	case 0: /* Screen: On; HSync: On, VSync: On */    
 	    vgablank = 0;
 	    write_xr(0x73, 0x00);
 	    read_xr(0x52, tmp);
-	    write_xr(0x52, tmp & 0xf7);	/* leave Panel Off mode */
-	    udelay(1000);
-	    /* for proper reinitialization */
-	    if ((i->xres == 800)||((i->xres == 640)&&(i->currentmode.bpp == 16))) {
-		CHIPS_8bpp_setmode(i->xres);
-		if (i->currentmode.bpp == 16) {
-		    udelay(500);
-		    CHIPS_16bpp_setmode(i->xres);
-		    if (!nohwcursor) {
-			CHIPS_cursorinit(i);
-			ct48fb_set_cursor_shape(i);
-		    }
-		}
-		CHIPS_setclock(i->currentmode.pixclock+1);
+	    if (tmp & 0x08) {
+		write_xr(0x52, tmp & 0xf7);	/* leave Panel Off mode */
+		udelay(1000);
+		i->panel_up = 1;
 	    }
+	    /* the mode check waits for the engine and may set a mode */
+	    if (in_interrupt())
+		schedule_task(&i->restore_task);
+	    else
+		ct48fb_unblank_restore(i);
 	break;
 	case 1: /* Screen: Off; HSync: On, VSync: On */
 	    write_xr(0x73, 0x00);
@@ -1061,6 +2513,10 @@ struct fbgen_hwswitch ct48fb_switch = {
 
 int __init ct48fb_init(void)
 {
+    struct ct48fb_par par;
+
+    if (!noregtrace)
+	ct48fb_trace_regs();
 
     if (check_region(0x3C0,32)) {
 	printk(KERN_ERR "ct48fb: VGA I/O region is already claimed\n");
@@ -1100,6 +2556,12 @@ int __init ct48fb_init(void)
     }
 
     fb_info.memsize = CHIPS_memorysize();
+    fb_info.vram.end = fb_info.memsize;
+    if (CHIPS_dualscan()) {
+	printk(KERN_INFO "ct48fb: dual scan panel, leaving the top %dK of video memory alone\n",
+	       CT48_VRAM_PANEL / 1024);
+	fb_info.vram.end -= CT48_VRAM_PANEL;
+    }
 
     fb_info.fbmem = CHIPS_linearbase();
     if (!request_mem_region(fb_info.fbmem, fb_info.memsize, "ct48fb"))
@@ -1121,7 +2583,7 @@ int __init ct48fb_init(void)
     fb_info.gen.info.fbops = &ct48fb_ops;
     fb_info.gen.info.disp = &disp;
 
-    fb_info.gen.info.switch_con = &fbgen_switch;
+    fb_info.gen.info.switch_con = &ct48fb_switch_con;
     fb_info.gen.info.updatevar = &fbgen_update_var;
     fb_info.gen.info.blank = &fbgen_blank;
 
@@ -1129,24 +2591,42 @@ int __init ct48fb_init(void)
     fb_info.gen.info.fontname[0] = '\0';
     fb_info.gen.info.pseudo_palette = pseudo_pal;
 
+    if (!nommio)
+	ct48fb_mmio_init();
+
     CHIPS_init();
+    ct48fb_blt_init();
+    init_timer(&fb_info.cmap_timer);
+    fb_info.cmap_timer.function = ct48fb_cmap_timer;
+    fb_info.cmap_timer.data = (unsigned long)&fb_info;
+    INIT_TQUEUE(&fb_info.restore_task, ct48fb_unblank_restore, &fb_info);
 
     if (noaccel) {
 	nohwcursor = 1;
 	noaccputc  = 1;
     }
 
-    if (modenum>3) {
+    if (modenum>4) {
 	printk (KERN_ERR "ct48fb: Modenum too big:%i:%s: This should never happen!\n",modenum,mode);
 	modenum = 0;
     }
 
-    if ((modenum==0)||(modenum==2))
-	bpp = 8;
-    else
-	bpp = 16;
+    bpp = ct48fb_predefined[modenum].var.bits_per_pixel;
 
     default_var = ct48fb_predefined[modenum].var;
+    if (mode_xres) {
+	/* timings come from ct48fb_decode_timing() */
+	default_var.xres = default_var.xres_virtual = mode_xres;
+	default_var.yres = default_var.yres_virtual = mode_yres;
+	default_var.left_margin = default_var.right_margin = default_var.hsync_len = 0;
+	default_var.upper_margin = default_var.lower_margin = default_var.vsync_len = 0;
+	default_var.sync = 0;
+	if (ct48fb_decode_var(&default_var, &par, &fb_info.gen)) {
+	    printk(KERN_ERR "ct48fb: no %dx%d mode, using %s\n", mode_xres, mode_yres,
+		   ct48fb_predefined[modenum].name);
+	    default_var = ct48fb_predefined[modenum].var;
+	}
+    }
 
     fb_info.xres = default_var.xres;		/// XXX it's not right
     fb_info.yres = default_var.yres;
@@ -1183,12 +2663,15 @@ int __init ct48fb_init(void)
     fb_info.cursor.enable = 0;
 
     if (!nohwcursor) {
+	ct48fb_own_get(CT48_OWN_DRIVER);
+	read_dr(DR09, fb_info.cursor.concolor);	/* the BIOS' colours */
 	CHIPS_cursorinit(&fb_info);
 	ct48fb_set_cursor_shape(&fb_info);
+	ct48fb_own_put();
     } else {
 	ct48fb_accel.cursor = NULL;
 	if ((fb_info.chipset == CT_548)||(fb_info.chipset == CT_545))
-	    outl(0x00000000, DR08);		/* turn off the cursor */
+	    write_dr(DR08, 0x00000000);		/* turn off the cursor */
     }
 
     printk(KERN_INFO "fb%d: %s frame buffer device\n", GET_FB_IDX(fb_info.gen.info.node),
@@ -1206,17 +2689,34 @@ int __init ct48fb_init(void)
     if (nohwcursor)
 	printk(KERN_INFO "fb%d: disabled hardware cursor\n", GET_FB_IDX(fb_info.gen.info.node));
 
+#ifdef CONFIG_PROC_FS
+    create_proc_read_entry("driver/ct48fb", 0, NULL, ct48fb_read_proc, NULL);
+#endif
+
     return 0;
 }
 
 void ct48fb_cleanup(struct fb_info *info)
 {
+    ct48fb_blt_sync();
+    del_timer_sync(&fb_info.bltq.timer);
+    del_timer_sync(&fb_info.cmap_timer);
+    flush_scheduled_tasks();
+#ifdef CONFIG_PROC_FS
+    remove_proc_entry("driver/ct48fb", NULL);
+#endif
     unregister_framebuffer(&fb_info.gen.info);
     CHIPS_enterleave(LEAVE);
     release_region(0x3C0, 32);
 
     if (!nohwcursor)
-        outl(0x00000020, DR08);		/* turn off the cursor */
+        write_dr(DR08, 0x00000020);		/* turn off the cursor */
+
+    if (ct48_mmio_base) {
+	ct48fb_use_regs(&ct48_pio_regs);
+	iounmap(ct48_mmio_base);
+	ct48_mmio_base = NULL;
+    }
 
     if (!noaccel) {
 	release_region(DR00,4);
@@ -1236,11 +2736,29 @@ void ct48fb_cleanup(struct fb_info *info)
 }
 
 static void __init ct48fb_mode_setup(char* options) {
-    int i;
+    int i, x, y, b;
+    char *s;
 
+    mode_xres = mode_yres = 0;
     for (i=0; ct48fb_predefined[i].name[0] && strcmp(options, ct48fb_predefined[i].name); i++);
-	if (ct48fb_predefined[i].name[0])
+	if (ct48fb_predefined[i].name[0]) {
 		modenum = i;
+		return;
+	}
+
+    /* any other size, on top of the predefined mode of that depth */
+    x = simple_strtoul(options, &s, 10);
+    if (*s++ != 'x')
+	return;
+    y = simple_strtoul(s, &s, 10);
+    if (*s++ != 'x')
+	return;
+    b = simple_strtoul(s, &s, 10);
+    if ((b != 8) && (b != 16))
+	return;
+    modenum = (b == 16) ? 1 : 0;
+    mode_xres = x;
+    mode_yres = y;
 }
 
 int __init ct48fb_setup(char *options)
@@ -1249,12 +2767,15 @@ int __init ct48fb_setup(char *options)
 
     /* set defaults */
     noaccel = 0;			/* enable acceleration by default */
-    noaccputc = 1;			/* disable accelerated putc by default */
+    noaccputc = 0;			/* enable accelerated putc by default */
     nohwcursor = 0;			/* enable hardware cursor by default */
     noblink = 1;			/* disable blinking because it looks like shit */
     noinverse = 1;			/* disable screen inverse */
+    nommio = 1;				/* port I/O for DR registers */
+    noregtrace = 1;
+    noypan = 0;				/* console scrolls by panning */
+    noywrap = 1;			/* but doesn't wrap around */
     modenum = 0;			/* default mode */
-    wasbmove = 0;
 
     fb_info.gen.info.fontname[0] = '\0';
 
@@ -1286,6 +2807,22 @@ int __init ct48fb_setup(char *options)
 	    noinverse = 1;
 	if (!strncmp(this_opt, "inverse", 7))
 	    noinverse = 0;
+	if (!strncmp(this_opt, "nommio", 6))
+	    nommio = 1;
+	if (!strncmp(this_opt, "mmio", 4))
+	    nommio = 0;
+	if (!strncmp(this_opt, "noregtrace", 10))
+	    noregtrace = 1;
+	if (!strncmp(this_opt, "regtrace", 8))
+	    noregtrace = 0;
+	if (!strncmp(this_opt, "noypan", 6))
+	    noypan = 1;
+	if (!strncmp(this_opt, "ypan", 4))
+	    noypan = 0;
+	if (!strncmp(this_opt, "noywrap", 7))
+	    noywrap = 1;
+	if (!strncmp(this_opt, "ywrap", 5))
+	    noywrap = 0;
     }
     return 0;
 }
@@ -1301,51 +2838,83 @@ int __init ct48fb_setup(char *options)
 #define ctLEFT2RIGHT            0x200
 #define ctSRCMONO               0x800
 #define ctPATMONO               0x1000
+#define ctBGTRANSPARENT         0x2000
 #define ctSRCSYSTEM             0x4000
 #define ctPATSOLID              0x80000L
 #define ctBitBLTBUSY		0x100000L
 
+/* register values packed the way the 6554x wants them */
+#define ctPITCH(srcPitch, dstPitch)	((((dstPitch) & 0xfff)<<16)|((srcPitch) & 0xfff))
+#define ctCOLOR8(c)			((((c) & 0xff)<<8)|((c) & 0xff))
+#define ctCOLOR16(c)			((c) & 0xffff)
+#define ctHEIGHTWIDTH(lines, bytes)	((((lines) & 0xfff)<<16)|((bytes) & 0xfff))
+
+/* write a BitBLT register unless it already holds val */
+static inline void ct48fb_dr_update(u_short dr, u_int val)
+{
+    struct ct48fb_drshadow *sh = &fb_info.shadow;
+    int n = CT48_DR(dr);
+
+    if ((sh->valid & (1<<n)) && (sh->val[n] == val)) {
+	fb_info.bltq.stat.skipped++;
+	return;
+    }
+    sh->val[n] = val;
+    sh->valid |= 1<<n;
+    write_dr(dr, val);
+}
+
+/* registers may have been changed behind our back (mode set, someone else) */
+static void ct48fb_blt_forget(void)
+{
+    fb_info.shadow.valid = 0;
+}
+
 /* These are the macro functions for programming the Register
  * addressed blitter for the 6554x's */
 static inline void ctSETPITCH(int srcPitch, int dstPitch)
 {
-    outl((((dstPitch & 0xfff)<<16)|(srcPitch & 0xfff)), DR00);
+    ct48fb_dr_update(DR00, ctPITCH(srcPitch, dstPitch));
 }
 static inline void ctSETBGCOLOR(int bgColor)
 {
-    outl(((bgColor & 0xff)<<8)|(bgColor & 0xff), DR02);
+    ct48fb_dr_update(DR02, ctCOLOR8(bgColor));
 }
 static inline void ctSETFGCOLOR(int fgColor)
 {
-    outl(((fgColor & 0xff)<<8)|(fgColor & 0xff), DR03);
+    ct48fb_dr_update(DR03, ctCOLOR8(fgColor));
 }
 static inline void ctSETBGCOLOR16(int bgColor)
 {
-    outl((bgColor & 0xffff), DR02);
+    ct48fb_dr_update(DR02, ctCOLOR16(bgColor));
 }
 static inline void ctSETFGCOLOR16(int fgColor)
 {
-    outl((fgColor & 0xffff), DR03);
+    ct48fb_dr_update(DR03, ctCOLOR16(fgColor));
 }
 static inline void ctSETROP(int op)
 {
-    outl(op, DR04);
+    ct48fb_dr_update(DR04, op);
 }
-static inline void ctBLTWAIT(void)
+static inline int ctBLTBUSY(void)
 {
-    while(inl(DR04)&ctBitBLTBUSY) { };
+    u_int tmp;
+
+    fb_info.bltq.stat.polls++;
+    read_dr(DR04, tmp);
+    return (tmp & ctBitBLTBUSY) != 0;
 }
 static inline void ctSETSRCADDR(u_long srcAddr)
 {
-    outl((srcAddr & 0x1FFFFFL), DR05);
+    write_dr(DR05, (srcAddr & 0x1FFFFFL));
 }
 static inline void ctSETDSTADDR(u_long dstAddr)
 {
-    outl((dstAddr & 0x1FFFFFL), DR06);
+    write_dr(DR06, (dstAddr & 0x1FFFFFL));
 }
 static inline void ctSETHEIGHTWIDTHGO(int lines, int bytes)
 {
-    outl((((lines & 0xfff)<<16)|(bytes & 0xfff)), DR07);
+    write_dr(DR07, ctHEIGHTWIDTH(lines, bytes));
 }
 static inline u_long BLTBYTEADDRESS(struct display *p, int x, int y)
 {
@@ -1377,40 +2946,468 @@ static unsigned int ctAluConv2[] =
     0x55,			/* ROP_INVERT : dest = ~dest; GXInvert */
 };
 
-static void ct48fb_acc_setup(struct display *p)
+/*
+ * BitBLT command queue
+ *
+ * Hooks don't sit waiting for the blitter any more: screen-to-screen and
+ * solid fill commands go into a small ring and get issued whenever the engine
+ * is found idle - by the next hook, by the drain timer or by ct48fb_blt_sync().
+ * Anything that is going to touch VRAM with the CPU (cfb8/cfb16 software
+ * paths, cursor image, system-source blits) has to own the engine and call
+ * ct48fb_blt_sync() first. Userspace mmap access can't be fenced, the timer
+ * empties the queue within a jiffy.
+ */
+
+/*
+ * Waiting for the engine
+ *
+ * Every DR04 poll is a slow bus cycle that also competes with the blitter's
+ * own memory traffic, so don't hammer it. Blit run time is estimated from
+ * the DR07 size and the current depth, the first poll is delayed by that
+ * much but never more than CT48_BLT_MAXSTEP, after that the poll interval
+ * backs off up to CT48_BLT_MAXSTEP. The per-depth estimate is corrected a
+ * bit after every wait that started right behind its blit, under the queue
+ * lock since the timer and ioctls wait too.
+ */
+
+#define CT48_BLT_MAXSTEP	32	/* longest pause between polls [us] */
+#define CT48_BLT_TIMEOUT	500000	/* give up after that long [us] */
+
+static u_int blt_us256[2] = { 6, 10 };	/* us per 256 bytes moved at 8/16bpp */
+
+/* remember how long the blit just started should take, queue lock held */
+static inline void ct48fb_blt_started(u_int hw)
 {
-#ifdef FBCON_HAS_CFB8
-    if (bpp==8)
-	fbcon_cfb8_setup(p);
-#endif
-#ifdef FBCON_HAS_CFB16
-    if (bpp==16)
-	fbcon_cfb16_setup(p);
-#endif
+    struct ct48fb_bltq *q = &fb_info.bltq;
+    u_long bytes = ((hw >> 16) & 0xfff) * (hw & 0xfff);
+
+    q->inflight_us = (bytes * blt_us256[bpp == 16]) >> 8;
+    q->inflight_jiffies = jiffies;
+    q->stat.blits++;
 }
 
-static void ct48fb_acc_bmove(struct display *p, int y1, int x1, int y2, int x2, int h, int w)
+/* wait until the engine is idle */
+static void ct48fb_blt_wait(void)
 {
-    u_int srcaddr, destaddr, op;
-    u_int linew;
+    struct ct48fb_bltq *q = &fb_info.bltq;
+    u_int *scale = &blt_us256[bpp == 16];
+    u_int est, step, waited;
+    unsigned long flags;
+    int fresh;
+
+    spin_lock_irqsave(&q->lock, flags);
+    est = q->inflight_us;
+    q->inflight_us = 0;
+    /* a blit started in an earlier jiffy has probably finished already */
+    fresh = est && (q->inflight_jiffies == jiffies);
+    spin_unlock_irqrestore(&q->lock, flags);
+
+    waited = 0;
+    if (fresh) {
+	waited = (est < CT48_BLT_MAXSTEP) ? est : CT48_BLT_MAXSTEP;
+	udelay(waited);
+    }
+    if (ctBLTBUSY()) {
+	q->stat.waits++;
+	step = 1;
+	do {
+	    if (waited >= CT48_BLT_TIMEOUT) {
+		q->stat.timeouts++;
+		if (q->stat.timeouts < 4)
+		    printk(KERN_ERR "ct48fb: BitBLT engine timed out\n");
+		break;
+	    }
+	    udelay(step);
+	    waited += step;
+	    if (step < CT48_BLT_MAXSTEP)
+		step <<= 1;
+	} while (ctBLTBUSY());
+    }
 
-    x1     *= fontwidth(p);
-    y1     *= fontheight(p);
-    x2     *= fontwidth(p);
-    y2     *= fontheight(p);
-    w      *= fontwidth(p);
-    h      *= fontheight(p);
+    spin_lock_irqsave(&q->lock, flags);
+    if (fresh) {
+	if (waited <= est) {
+	    /* estimate was long enough - try a bit less next time */
+	    if (*scale > 1)
+		*scale -= (*scale >> 4) ? (*scale >> 4) : 1;
+	} else
+	    *scale += (*scale >> 3) + 1;	/* estimate was too short */
+    }
+    q->stat.wait_us += waited;
+    spin_unlock_irqrestore(&q->lock, flags);
+}
 
-    linew = p->var.xres * ((p->var.bits_per_pixel)>>3);
+static inline void ct48fb_blt_issue(struct ct48fb_blt_cmd *c)
+{
+    if (c->flags & CT48_BLT_START) {
+	/* engine is idle, everything drawn before the pan is on screen */
+	CHIPS_setdisplaystart(c->dst);
+	CHIPS_setlinecompare(c->src);
+	return;
+    }
+    ct48fb_dr_update(DR04, c->rop);
+    if (c->flags & CT48_BLT_PAT)
+	ct48fb_dr_update(DR01, c->pat);
+    if (c->flags & CT48_BLT_SRC)
+	ctSETSRCADDR(c->src);
+    ctSETDSTADDR(c->dst);
+    if (c->flags & CT48_BLT_COLOR) {
+	ct48fb_dr_update(DR02, c->bg);
+	ct48fb_dr_update(DR03, c->fg);
+    }
+    ct48fb_dr_update(DR00, c->pitch);
+    write_dr(DR07, c->hw);
+    ct48fb_blt_started(c->hw);
+}
 
-    srcaddr = BLTBYTEADDRESS(p, x1, y1);
-    destaddr = BLTBYTEADDRESS(p, x2, y2);
+/* issue queued commands as long as the engine is idle, never waits */
+static void ct48fb_blt_kick(struct ct48fb_bltq *q)
+{
+    while (q->head != q->tail) {
+	if (ctBLTBUSY())
+	    return;
+	ct48fb_blt_issue(&q->cmd[q->head & (CT48_BLTQ_LEN-1)]);
+	q->head++;
+    }
+}
+
+static void ct48fb_blt_timer(unsigned long data)
+{
+    struct ct48fb_bltq *q = (struct ct48fb_bltq *)data;
+    unsigned long flags;
+
+    /* whoever has the engine kicks the queue too, try again later */
+    if (down_trylock(&fb_info.own.sem)) {
+	mod_timer(&q->timer, jiffies + 1);
+	return;
+    }
+    spin_lock_irqsave(&q->lock, flags);
+    ct48fb_blt_kick(q);
+    if (q->head != q->tail)
+	mod_timer(&q->timer, jiffies + 1);
+    spin_unlock_irqrestore(&q->lock, flags);
+    up(&fb_info.own.sem);
+}
+
+static void ct48fb_blt_init(void)
+{
+    struct ct48fb_bltq *q = &fb_info.bltq;
+
+    q->head = q->tail = 0;
+    ct48fb_blt_forget();
+    spin_lock_init(&q->lock);
+    init_MUTEX(&fb_info.own.sem);
+    fb_info.own.owner = fb_info.own.last = CT48_OWN_NONE;
+    fb_info.own.lease = NULL;
+    init_timer(&q->timer);
+    q->timer.function = ct48fb_blt_timer;
+    q->timer.data = (unsigned long)q;
+}
+
+static void ct48fb_blt_queue(struct ct48fb_blt_cmd *c)
+{
+    struct ct48fb_bltq *q = &fb_info.bltq;
+    unsigned long flags;
+
+    spin_lock_irqsave(&q->lock, flags);
+    while (q->tail - q->head >= CT48_BLTQ_LEN) {
+	/* ring is full, wait for a slot (without the lock held) */
+	spin_unlock_irqrestore(&q->lock, flags);
+	ct48fb_blt_wait();
+	spin_lock_irqsave(&q->lock, flags);
+	ct48fb_blt_kick(q);
+    }
+    q->cmd[q->tail & (CT48_BLTQ_LEN-1)] = *c;
+    q->tail++;
+    ct48fb_blt_kick(q);			/* goes out right away if the engine is idle */
+    if ((q->head != q->tail) && !timer_pending(&q->timer))
+	mod_timer(&q->timer, jiffies + 1);
+    spin_unlock_irqrestore(&q->lock, flags);
+}
+
+/* drain the queue and wait until the engine is idle */
+static void ct48fb_blt_sync(void)
+{
+    struct ct48fb_bltq *q = &fb_info.bltq;
+    unsigned long flags;
+    int empty;
+
+    if (noaccel)
+	return;
+    do {
+	ct48fb_blt_wait();
+	spin_lock_irqsave(&q->lock, flags);
+	ct48fb_blt_kick(q);
+	empty = (q->head == q->tail);
+	spin_unlock_irqrestore(&q->lock, flags);
+    } while (!empty);
+    ct48fb_blt_wait();
+}
+
+/* start c right now, caller owns the engine and has synced it */
+static void ct48fb_blt_start(struct ct48fb_blt_cmd *c)
+{
+    struct ct48fb_bltq *q = &fb_info.bltq;
+    unsigned long flags;
+
+    spin_lock_irqsave(&q->lock, flags);
+    ct48fb_blt_issue(c);
+    q->head++;				/* counts as queued and issued */
+    q->tail++;
+    spin_unlock_irqrestore(&q->lock, flags);
+}
+
+/*
+ * Fences are queue positions: the fence of a command is tail right after it
+ * went in. It has passed once a later command got issued (which needed the
+ * engine idle) or it was the last one issued and the engine is idle now.
+ */
+static u_int ct48fb_blt_fence(void)
+{
+    return fb_info.bltq.tail;
+}
+
+static int ct48fb_blt_passed(u_int fence)
+{
+    struct ct48fb_bltq *q = &fb_info.bltq;
+    unsigned long flags;
+    int passed;
+
+    spin_lock_irqsave(&q->lock, flags);
+    ct48fb_blt_kick(q);
+    if ((int)(q->head - fence) < 0)
+	passed = 0;
+    else if (q->head == fence)
+	passed = !ctBLTBUSY();
+    else
+	passed = 1;
+    spin_unlock_irqrestore(&q->lock, flags);
+    return passed;
+}
+
+/*
+ * Engine ownership
+ *
+ * Queueing blits, programming the engine directly, feeding the system source
+ * window and writing VRAM with the CPU all need the engine to themselves.
+ * Text hooks, the hardware cursor, software cursor revc, mode setting and
+ * the ioctls take turns through a semaphore, so nobody waits for the engine
+ * or sets a mode with interrupts off. In interrupt context - the fbcon
+ * cursor timer, printk from a handler, the drain timer - it is only tried
+ * and the work is skipped when the engine is busy. The semaphore isn't
+ * recursive: only entry points take it, helpers expect it held. Queued
+ * commands carry their full register state, so nothing is assumed about
+ * DR contents across a handover.
+ */
+
+/* process context only */
+static void ct48fb_own_get(int who)
+{
+    struct ct48fb_own *o = &fb_info.own;
+
+    down(&o->sem);
+    if (o->last != who) {
+	o->handovers++;
+	o->last = who;
+    }
+    o->owner = who;
+}
+
+static void ct48fb_own_put(void)
+{
+    struct ct48fb_own *o = &fb_info.own;
+
+    o->owner = CT48_OWN_NONE;
+    up(&o->sem);
+}
+
+/*
+ * Like ct48fb_own_get(), but gives up when a userspace program has leased
+ * the engine (CT48FB_ENGINE_ACQUIRE), or in interrupt context when someone
+ * else has it. Returns 0 then and the engine is not ours - VRAM must not
+ * be touched either, the program may be blitting.
+ */
+static int ct48fb_own_try(int who)
+{
+    struct ct48fb_own *o = &fb_info.own;
+
+    if (in_interrupt()) {
+	if (down_trylock(&o->sem))
+	    return 0;
+    } else
+	down(&o->sem);
+    if (o->lease) {
+	if (who == CT48_OWN_TEXT)
+	    o->dropped++;
+	up(&o->sem);
+	return 0;
+    }
+    if (o->last != who) {
+	o->handovers++;
+	o->last = who;
+    }
+    o->owner = who;
+    return 1;
+}
+
+/*
+ * Hand the engine to the file until it gives it back or is closed. Queued
+ * commands, display start changes among them, all go out first; after that
+ * nothing in the driver touches the engine, the CRTC or offscreen VRAM:
+ * mode changes and the unblank mode check wait for the end of the lease,
+ * pans fail with EBUSY and console drawing is dropped (and counted).
+ */
+static int ct48fb_lease_get(struct file *file)
+{
+    struct ct48fb_own *o = &fb_info.own;
+    int err = 0;
+
+    ct48fb_own_get(CT48_OWN_DRIVER);
+    if (o->lease && (o->lease != file)) {
+	err = -EBUSY;
+    } else if (!o->lease) {
+	ct48fb_blt_sync();
+	o->lease = file;
+	o->lease_pid = current->pid;
+	o->dropped = 0;
+    }
+    ct48fb_own_put();
+    return err;
+}
+
+static int ct48fb_lease_put(struct file *file)
+{
+    struct ct48fb_own *o = &fb_info.own;
+    int err = 0;
+
+    ct48fb_own_get(CT48_OWN_DRIVER);
+    if (!o->lease || (o->lease != file)) {
+	err = -EPERM;
+    } else {
+	ct48fb_blt_wait();		/* it may have left a blit running */
+	ct48fb_blt_forget();		/* registers changed behind the shadow */
+	/* offscreen VRAM could have been used too */
+	fb_info.glyphs.font = NULL;
+	fb_info.pattern_ok = 0;
+	fb_info.cursor.w = 0;
+	ct48fb_cursor_forget(&fb_info);
+	o->lease = NULL;
+	if (fb_info.deferred & CT48_DEFER_RESTORE)
+	    ct48fb_restore_mode(&fb_info);
+	if (fb_info.deferred & CT48_DEFER_PAR) {
+	    fb_info.reread = 1;		/* it may have set a mode of its own */
+	    ct48fb_program_par(&fb_info, &fb_info.deferred_par);
+	}
+	if (ct48fb_cursor_user(&fb_info))
+	    ct48fb_set_cursor_shape(&fb_info);	/* the console's is redrawn with w */
+	else if (fb_info.deferred & CT48_DEFER_CURSOR)
+	    ct48fb_cursor_console(&fb_info);	/* the pointer went meanwhile */
+	fb_info.deferred = 0;
+	if (o->dropped)
+	    printk(KERN_INFO "ct48fb: %lu console updates lost while the engine was leased\n",
+		   o->dropped);
+    }
+    ct48fb_own_put();
+    return err;
+}
+
+#ifdef CONFIG_PROC_FS
+static int ct48fb_read_proc(char *page, char **start, off_t off, int count, int *eof, void *data)
+{
+    struct ct48fb_bltstat *st = &fb_info.bltq.stat;
+    u_int i, n;
+    int len;
+
+    len = sprintf(page,
+		  "blits:\t\t%lu\n"
+		  "busy waits:\t%lu\n"
+		  "status polls:\t%lu\n"
+		  "wait time:\t%lu us\n"
+		  "timeouts:\t%lu\n"
+		  "writes saved:\t%lu\n"
+		  "estimate:\t%u/%u us per 256 bytes (8/16bpp)\n",
+		  st->blits, st->waits, st->polls, st->wait_us, st->timeouts,
+		  st->skipped, blt_us256[0], blt_us256[1]);
+    len += sprintf(page+len, "handovers:\t%lu\n", fb_info.own.handovers);
+    len += sprintf(page+len, "vblank waits:\t%lu (%lu timed out)\n", CHIPS_vblwaits, CHIPS_vbltimeouts);
+    len += sprintf(page+len, "mode restores:\t%lu (%lu registers written)\n", CHIPS_restores, CHIPS_restored);
+    len += sprintf(page+len, "palette:\t%lu entries written, %lu unchanged, %lu retrace loads\n",
+		   CHIPS_dacwrites, CHIPS_dacskips, CHIPS_dacflushes);
+    len += sprintf(page+len, "cursor images:\t%lu loaded, %lu switches\n",
+		   fb_info.cslot_loads, fb_info.cslot_switches);
+    if (fb_info.cursor.user)
+	len += sprintf(page+len, "cursor:\t\tpid %d, console %d\n",
+		       fb_info.cursor.pid, fb_info.cursor.con + 1);
+    if (fb_info.own.lease)
+	len += sprintf(page+len, "leased to:\tpid %d, %lu console updates lost\n",
+		       fb_info.own.lease_pid, fb_info.own.dropped);
+    if (fb_info.glyphs.font && fb_info.glyphs.ok)
+	len += sprintf(page+len, "glyph cache:\t%d %dx%d glyphs @ 0x%lx\n", fb_info.glyphs.count,
+		       fb_info.glyphs.w, fb_info.glyphs.h, fb_info.glyphs.base);
+    else
+	len += sprintf(page+len, "glyph cache:\tempty\n");
+    len += sprintf(page+len, "vram:\t\t%06x-%06lx screen\n", 0, fb_info.vram.start - 1);
+    for (i = 0; i < fb_info.vram.count; i++) {
+	struct ct48fb_vblock *b = &fb_info.vram.blk[i];
+
+	len += sprintf(page+len, "\t\t%06lx-%06lx %s", b->base, b->base + b->size - 1, b->what);
+	if (b->pid)
+	    len += sprintf(page+len, " (pid %d)", b->pid);
+	len += sprintf(page+len, "\n");
+    }
+    if (fb_info.vram.end < fb_info.memsize)
+	len += sprintf(page+len, "\t\t%06lx-%06lx panel, left alone\n", fb_info.vram.end, fb_info.memsize - 1);
+    if (ct48_regs == &ct48_trace_regs) {
+	len += sprintf(page+len, "registers:\t%s, traced\n", ct48_traced->name);
+	/* oldest first */
+	n = ct48_trace_pos < CT48_TRACE_LEN ? ct48_trace_pos : CT48_TRACE_LEN;
+	for (i = ct48_trace_pos - n; i != ct48_trace_pos; i++)
+	    len += sprintf(page+len, "%c %04x %08x\n",
+			   ct48_trace[i & (CT48_TRACE_LEN-1)].op,
+			   ct48_trace[i & (CT48_TRACE_LEN-1)].port,
+			   ct48_trace[i & (CT48_TRACE_LEN-1)].val);
+    } else
+	len += sprintf(page+len, "registers:\t%s\n", ct48_regs->name);
+    if (off >= len) {
+	*eof = 1;
+	return 0;
+    }
+    *start = page + off;
+    len -= off;
+    if (len > count)
+	len = count;
+    else
+	*eof = 1;
+    return len;
+}
+#endif
+
+static void ct48fb_acc_setup(struct display *p)
+{
+#ifdef FBCON_HAS_CFB8
+    if (bpp==8)
+	fbcon_cfb8_setup(p);
+#endif
+#ifdef FBCON_HAS_CFB16
+    if (bpp==16)
+	fbcon_cfb16_setup(p);
+#endif
+}
+
+/* screen-to-screen copy in pixels, direction picked so overlapping areas work */
+static void ct48fb_blt_copycmd(struct ct48fb_blt_cmd *cmd, int x1, int y1, int x2, int y2,
+			       int w, int h, u_int linew, int bytespp)
+{
+    u_int srcaddr, destaddr, op;
+
+    srcaddr = y1 * linew + x1 * bytespp;
+    destaddr = y2 * linew + x2 * bytespp;
 
     op = ctAluConv[ROP_COPY];
     if (x1 < x2) {
 	op |= ctRIGHT2LEFT;
-	srcaddr += w * ((p->var.bits_per_pixel)>>3) - 1;
-	destaddr += w * ((p->var.bits_per_pixel)>>3) - 1;
+	srcaddr += w * bytespp - 1;
+	destaddr += w * bytespp - 1;
     } else {
 	op |= ctLEFT2RIGHT;
     }
@@ -1422,55 +3419,225 @@ static void ct48fb_acc_bmove(struct display *p, int y1, int x1, int y2, int x2,
 	op |= ctTOP2BOTTOM;
     }
 
-    ctBLTWAIT();
-    ctSETROP(op);
-    ctSETSRCADDR(srcaddr);
-    ctSETDSTADDR(destaddr);
-    ctSETPITCH(linew, linew);
-    ctSETHEIGHTWIDTHGO(h, w * ((p->var.bits_per_pixel)>>3));
-    ctBLTWAIT();
-    wasbmove = 1;
+    cmd->flags = CT48_BLT_SRC;
+    cmd->rop = op;
+    cmd->src = srcaddr;
+    cmd->dst = destaddr;
+    cmd->pitch = ctPITCH(linew, linew);
+    cmd->hw = ctHEIGHTWIDTH(h, w * bytespp);
 }
 
-static void ct48fb_acc_clear(struct vc_data *conp, struct display *p, int sy, int sx, int h, int w)
+static void ct48fb_acc_bmove(struct display *p, int y1, int x1, int y2, int x2, int h, int w)
 {
-    u_int destaddr;
-    u_int bgx;
+    struct ct48fb_blt_cmd cmd;
+    int bytespp = (p->var.bits_per_pixel)>>3;
+
+    ct48fb_blt_copycmd(&cmd, x1 * fontwidth(p), y1 * fontheight(p), x2 * fontwidth(p), y2 * fontheight(p),
+		       w * fontwidth(p), h * fontheight(p), p->var.xres * bytespp, bytespp);
+    if (!ct48fb_own_try(CT48_OWN_TEXT))
+	return;
+    ct48fb_blt_queue(&cmd);
+    ct48fb_own_put();
+}
+
+/*
+ * Queue a solid pattern fill of a pixel rectangle. color is already packed
+ * for DR02/DR03, with ROP_XOR it's the mask to flip. Caller owns the engine.
+ */
+static void ct48fb_acc_rect(struct display *p, int x, int y, int w, int h, u_int color, int rop)
+{
+    struct ct48fb_blt_cmd cmd;
     u_int linew;
 
-    sx     *= fontwidth(p);
-    sy     *= fontheight(p);
-    w      *= fontwidth(p);
-    h      *= fontheight(p);
+    if ((w <= 0) || (h <= 0))
+	return;
+
+    linew = p->var.xres * ((p->var.bits_per_pixel)>>3);
 
-    destaddr = BLTBYTEADDRESS(p, sx, sy);
+    cmd.flags = CT48_BLT_COLOR;
+    cmd.dst = BLTBYTEADDRESS(p, x, y);
+    cmd.fg = cmd.bg = color;
+    cmd.rop = ctAluConv2[rop] | ctTOP2BOTTOM | ctLEFT2RIGHT | ctPATSOLID | ctPATMONO;
+    cmd.pitch = ctPITCH(0, linew);
+    cmd.hw = ctHEIGHTWIDTH(h, w * ((p->var.bits_per_pixel)>>3));
+    ct48fb_blt_queue(&cmd);
+}
+
+/* console background colour packed for the engine */
+static inline u_int ct48fb_acc_bgcol(struct vc_data *conp, struct display *p)
+{
+    if (p->var.bits_per_pixel == 8)
+	return ctCOLOR8(attr_bgcol_ec(p, conp));
+    else
+	return ctCOLOR16(((u16 *)p->dispsw_data)[attr_bgcol_ec(p, conp)]);
+}
 
+static void ct48fb_acc_clear(struct vc_data *conp, struct display *p, int sy, int sx, int h, int w)
+{
+
+    if (!ct48fb_own_try(CT48_OWN_TEXT))
+	return;
+    ct48fb_acc_rect(p, sx * fontwidth(p), sy * fontheight(p), w * fontwidth(p), h * fontheight(p),
+		    ct48fb_acc_bgcol(conp, p), ROP_COPY);
+    ct48fb_own_put();
+}
+
+/*
+ * Invert a rectangle of character cells the way cfb8/cfb16 revc do it:
+ * 8bpp flips the low 4 bits (swaps the 16 console colours), 16bpp flips
+ * everything. An XOR pattern blit, so VRAM is never read over the bus.
+ * Caller owns the engine.
+ */
+static void ct48fb_acc_invert(struct display *p, int sx, int sy, int w, int h)
+{
+    u_int mask;
+
+    if (p->var.bits_per_pixel == 8)
+	mask = ctCOLOR8(0x0f);
+    else
+	mask = ctCOLOR16(0xffff);
+    ct48fb_acc_rect(p, sx * fontwidth(p), sy * fontheight(p), w * fontwidth(p), h * fontheight(p),
+		    mask, ROP_XOR);
+}
+
+/*
+ * Glyph cache
+ *
+ * The whole console font is copied once into VRAM after the pattern slot,
+ * one glyph per dword aligned slot with its rows packed just like in
+ * fontdata (1 or 2 bytes each). A single character is then a screen-to-
+ * screen mono expansion that goes through the queue like any other blit,
+ * the CPU doesn't touch glyph data. Longer runs are still streamed by
+ * ct48fb_acc_putrun(), one blit beats one per character. The cache is
+ * dropped on font and mode change and reloaded on the next putc.
+ */
+
+/* make sure the cache holds p's font, 0 if it can't be used */
+static int ct48fb_glyphs_load(struct display *p)
+{
+    struct ct48fb_glyphs *g = &fb_info.glyphs;
+    u_int step, cellsize, count, i, j;
+    u_char *src, *dest;
+
+    step = fontwidth(p) <= 8 ? 1 : 2;
+    cellsize = fontheight(p) * step;
+    count = p->charmask + 1;
+
+    if ((g->font == p->fontdata) && (g->w == fontwidth(p)) && (g->h == fontheight(p)) && (g->count == count))
+	return g->ok;
+
+    if (g->ok)
+	ct48fb_vram_free(g->base);
+    g->font = p->fontdata;
+    g->w = fontwidth(p);
+    g->h = fontheight(p);
+    g->count = count;
+    g->size = (cellsize + 3) & ~3;
+    g->base = ct48fb_vram_alloc(count * g->size, 4, "glyphs", NULL);
+    g->ok = (g->base != CT48_VRAM_NONE);
+    if (!g->ok)
+	return 0;
+
+    ct48fb_blt_sync();
+    src = p->fontdata;
+    dest = fb_info.fbmem_virt + g->base;
+    for (i = 0; i < count; i++) {
+	for (j = 0; j < cellsize; j++)
+	    fb_writeb(src[j], dest + j);
+	src += cellsize;
+	dest += g->size;
+    }
+    return 1;
+}
+
+/* queue one character expanded from the glyph cache */
+static void ct48fb_acc_putglyph(struct display *p, u_int c, int yy, int xx)
+{
+    struct ct48fb_glyphs *g = &fb_info.glyphs;
+    struct ct48fb_blt_cmd cmd;
+
+    cmd.flags = CT48_BLT_SRC | CT48_BLT_COLOR;
+    cmd.rop = ctAluConv[ROP_COPY] | ctSRCMONO | ctTOP2BOTTOM | ctLEFT2RIGHT;
+    cmd.src = g->base + (c & p->charmask) * g->size;
+    cmd.dst = BLTBYTEADDRESS(p, xx * fontwidth(p), yy * fontheight(p));
+    cmd.pitch = ctPITCH(fontwidth(p) <= 8 ? 1 : 2, p->var.xres * ((p->var.bits_per_pixel)>>3));
+    if (p->var.bits_per_pixel == 8) {
+	cmd.bg = ctCOLOR8(attr_bgcol(p, c));
+	cmd.fg = ctCOLOR8(attr_fgcol(p, c));
+    } else {
+	cmd.bg = ctCOLOR16(((u16 *)p->dispsw_data)[attr_bgcol(p, c)]);
+	cmd.fg = ctCOLOR16(((u16 *)p->dispsw_data)[attr_fgcol(p, c)]);
+    }
+    cmd.hw = ctHEIGHTWIDTH(fontheight(p), fontwidth(p) * ((p->var.bits_per_pixel)>>3));
+    ct48fb_blt_queue(&cmd);
+}
+
+/*
+ * Draw a run of characters sharing one attribute with a single system-to-
+ * screen mono expansion. DR07 counts expanded bytes and the chip flushes
+ * the source at the end of every scanline, so each line of the run's
+ * glyph rows is streamed padded to a dword. Only 8 and 16 pixel wide fonts
+ * are accepted (see fontwidthmask), each glyph row is then 1 or 2 bytes.
+ * Caller owns the engine.
+ */
+static void ct48fb_acc_putrun(struct display *p, const unsigned short *s, int count, int yy, int xx)
+{
+    struct ct48fb_blt_cmd cmd;
+    u_int c, linew, step, cellsize, row, data;
+    u_char *chardata;
+    u32 *dest;
+    int i, j, n;
+
+    c = scr_readw(s);
+    step = fontwidth(p) <= 8 ? 1 : 2;
+    cellsize = fontheight(p) * step;
     linew = p->var.xres * ((p->var.bits_per_pixel)>>3);
 
-    ctBLTWAIT();
-    ctSETDSTADDR(destaddr);
+    cmd.flags = CT48_BLT_SRC | CT48_BLT_COLOR;
+    cmd.rop = ctAluConv[ROP_COPY] | ctSRCMONO | ctSRCSYSTEM | ctTOP2BOTTOM | ctLEFT2RIGHT;
+    cmd.src = 0;			/* dword aligned, no offset between lines */
+    cmd.dst = BLTBYTEADDRESS(p, xx * fontwidth(p), yy * fontheight(p));
+    cmd.pitch = ctPITCH(0, linew);
     if (p->var.bits_per_pixel == 8) {
-	bgx=attr_bgcol_ec(p, conp);
-	ctSETFGCOLOR(bgx); ctSETBGCOLOR(bgx);
+	cmd.bg = ctCOLOR8(attr_bgcol(p, c));
+	cmd.fg = ctCOLOR8(attr_fgcol(p, c));
     } else {
-	bgx=((u16 *)p->dispsw_data)[attr_bgcol_ec(p, conp)];
-	ctSETFGCOLOR16(bgx); ctSETBGCOLOR16(bgx);
+	cmd.bg = ctCOLOR16(((u16 *)p->dispsw_data)[attr_bgcol(p, c)]);
+	cmd.fg = ctCOLOR16(((u16 *)p->dispsw_data)[attr_fgcol(p, c)]);
+    }
+    cmd.hw = ctHEIGHTWIDTH(fontheight(p), count * fontwidth(p) * ((p->var.bits_per_pixel)>>3));
+
+    /* the CPU feeds the data, engine has to be idle - and stay ours */
+    ct48fb_blt_sync();
+    ct48fb_blt_start(&cmd);
+    dest = (u32 *)fb_info.fbmem_virt;	/* any VRAM address will do */
+    for (row = 0; row < fontheight(p); row++) {
+	data = 0;
+	n = 0;
+	for (i = 0; i < count; i++) {
+	    chardata = p->fontdata + (scr_readw(s+i) & p->charmask) * cellsize + row * step;
+	    for (j = 0; j < step; j++) {
+		data |= chardata[j] << (n<<3);	/* byte 0 is expanded first */
+		if (++n == 4) {
+		    fb_writel(data, dest++);
+		    data = 0;
+		    n = 0;
+		}
+	    }
+	}
+	if (n)
+	    fb_writel(data, dest++);
     }
-    ctSETROP(ctAluConv2[ROP_COPY] | ctTOP2BOTTOM | ctLEFT2RIGHT | ctPATSOLID | ctPATMONO);
-    ctSETPITCH(0, linew);
-    ctSETHEIGHTWIDTHGO(h, w * ((p->var.bits_per_pixel)>>3));
-    ctBLTWAIT();
 }
 
 static void ct48fb_acc_putc(struct vc_data *conp, struct display *p, int c, int yy, int xx)
 {
-    u_int destaddr;
-    u_int bgx, fgx;
-    u_int linew,step;
-    u_char *chardata;
+    unsigned short ch = c;
 
-    if (noaccputc || wasbmove) {
-	wasbmove = 0;
+    if (!ct48fb_own_try(CT48_OWN_TEXT))
+	return;
+    if (noaccputc || (fontwidth(p) & 7)) {
+	ct48fb_blt_sync();
 #ifdef FBCON_HAS_CFB8
 	if (bpp==8)
     	    fbcon_cfb8_putc(conp, p, c, yy, xx);
@@ -1479,87 +3646,103 @@ static void ct48fb_acc_putc(struct vc_data *conp, struct display *p, int c, int
 	if (bpp==16)
 	    fbcon_cfb16_putc(conp, p, c, yy, xx);
 #endif
+    } else if (ct48fb_glyphs_load(p)) {
+	ct48fb_acc_putglyph(p, c, yy, xx);
     } else {
-
-	linew = p->var.xres * ((p->var.bits_per_pixel)>>3);
-
-        xx *= fontwidth(p);
-	yy *= fontheight(p);
-	if (fontwidth(p) <= 8)
-    	    step = 1;
-	else if (fontwidth(p) <= 16)
-	    step = 2;
-	else
-	    step = 4;
-
-	destaddr = BLTBYTEADDRESS(p, xx, yy);
-	chardata = p->fontdata+(c&p->charmask)*fontheight(p)*step;
-
-	ctBLTWAIT();
-	ctSETSRCADDR(0);
-	ctSETDSTADDR(destaddr);
-	if (p->var.bits_per_pixel == 8) {
-	    bgx=attr_bgcol(p, c);
-	    fgx=attr_fgcol(p, c);
-	    ctSETFGCOLOR(fgx); ctSETBGCOLOR(bgx);
-	} else {
-	    bgx=((u16 *)p->dispsw_data)[attr_bgcol(p, c)];
-	    fgx=((u16 *)p->dispsw_data)[attr_fgcol(p, c)];
-	    ctSETFGCOLOR16(fgx); ctSETBGCOLOR16(bgx);
-	}
-	ctSETPITCH(0, linew);
-	ctSETROP(ctAluConv[ROP_COPY] | ctSRCMONO | ctSRCSYSTEM | ctTOP2BOTTOM | ctLEFT2RIGHT);
-	ctSETHEIGHTWIDTHGO(fontheight(p), step);
-	fb_memmove(fb_info.fbmem_virt, chardata, fontheight(p)*step);
-	ctBLTWAIT();
+	ct48fb_acc_putrun(p, &ch, 1, yy, xx);
     }
+    ct48fb_own_put();
 }
 
 static void ct48fb_acc_putcs(struct vc_data *conp, struct display *p, const unsigned short *s, int counter, int yy, int xx)
 {
-    ctBLTWAIT();
+    u_int c, a;
+    int n;
+
+    if (!ct48fb_own_try(CT48_OWN_TEXT))
+	return;
+    if (noaccputc || (fontwidth(p) & 7)) {
+	ct48fb_blt_sync();
 #ifdef FBCON_HAS_CFB8
-    if (bpp==8)
-	fbcon_cfb8_putcs(conp, p, s, counter, yy, xx);
+	if (bpp==8)
+	    fbcon_cfb8_putcs(conp, p, s, counter, yy, xx);
 #endif
 #ifdef FBCON_HAS_CFB16
-    if (bpp==16)
-	fbcon_cfb16_putcs(conp, p, s, counter, yy, xx);
+	if (bpp==16)
+	    fbcon_cfb16_putcs(conp, p, s, counter, yy, xx);
 #endif
+    } else {
+	/*
+	 * One blit for every run of equal colours, a lone character comes
+	 * from the glyph cache. Expanding a long run from the cache would
+	 * take a queued blit per character and fill the ring.
+	 */
+	while (counter > 0) {
+	    c = scr_readw(s);
+	    for (n = 1; n < counter; n++) {
+		a = scr_readw(s+n);
+		if ((attr_fgcol(p, a) != attr_fgcol(p, c)) || (attr_bgcol(p, a) != attr_bgcol(p, c)))
+		    break;
+	    }
+	    if ((n == 1) && ct48fb_glyphs_load(p))
+		ct48fb_acc_putglyph(p, c, yy, xx);
+	    else
+		ct48fb_acc_putrun(p, s, n, yy, xx);
+	    s += n;
+	    xx += n;
+	    counter -= n;
+	}
+    }
+    ct48fb_own_put();
 }
 
 static void ct48fb_acc_revc(struct display *p, int xx, int yy)
 {
-    /* I don't give a shit about making an accelerated version of this
-       as the only place where it is used is blinking software cursor */
-    ctBLTWAIT();
-#ifdef FBCON_HAS_CFB8
-    if (bpp==8)
-	fbcon_cfb8_revc(p, xx, yy);
-#endif
-#ifdef FBCON_HAS_CFB16
-    if (bpp==16)
-	fbcon_cfb16_revc(p, xx, yy);
-#endif
+
+    /* software cursor, called from the fbcon timer too */
+    if (!ct48fb_own_try(CT48_OWN_CURSOR))
+	return;
+    ct48fb_acc_invert(p, xx, yy, 1, 1);
+    ct48fb_own_put();
 }
 
+/* same geometry as fbcon_cfb8_clear_margins(), filled by the engine */
 static void ct48fb_acc_clear_margins(struct vc_data *conp, struct display *p, int bottom_only)
 {
-    ctBLTWAIT();
-#ifdef FBCON_HAS_CFB8
-    if (bpp==8)
-	fbcon_cfb8_clear_margins(conp, p, bottom_only);
-#endif
-#ifdef FBCON_HAS_CFB16
-    if (bpp==16)
-	fbcon_cfb16_clear_margins(conp, p, bottom_only);
-#endif
+    u_int right_start = conp->vc_cols * fontwidth(p);
+    u_int bottom_start = conp->vc_rows * fontheight(p);
+    u_int bottom_h = p->var.yres - bottom_start;
+    u_int bgx = ct48fb_acc_bgcol(conp, p);
+    u_int h;
+
+    if (!ct48fb_own_try(CT48_OWN_TEXT))
+	return;
+    if (!bottom_only)
+	ct48fb_acc_rect(p, right_start, 0, p->var.xres - right_start, p->var.yres_virtual, bgx, ROP_COPY);
+    bottom_start += p->var.yoffset;
+    if (bottom_start >= p->var.yres_virtual)
+	bottom_start -= p->var.yres_virtual;	/* wrapped */
+    if (bottom_start + bottom_h > p->var.yres_virtual) {
+	/* straddles the end of the buffer, the rest is at its top */
+	h = p->var.yres_virtual - bottom_start;
+	ct48fb_acc_rect(p, 0, bottom_start, right_start, h, bgx, ROP_COPY);
+	bottom_start = 0;
+	bottom_h -= h;
+    }
+    ct48fb_acc_rect(p, 0, bottom_start, right_start, bottom_h, bgx, ROP_COPY);
+    ct48fb_own_put();
 }
 
 static void ct48fb_acc_cursor(struct display* p, int mode, int x, int y)
 {
     struct ct48fb_info *fb = (struct ct48fb_info *)p->fb_info;
 
+    if (!ct48fb_own_try(CT48_OWN_CURSOR))
+	return;
+    if (ct48fb_cursor_user(fb)) {
+	ct48fb_own_put();		/* a program has it */
+	return;
+    }
     if ((fontwidth(p) != fb->cursor.w)||(fontheight(p) != fb->cursor.h)) {
 	fb->cursor.w = fontwidth(p);
 	fb->cursor.h = fontheight(p);
@@ -1569,60 +3752,126 @@ static void ct48fb_acc_cursor(struct display* p, int mode, int x, int y)
     x *= fontwidth(p);
     x = x & 0xFFFF;
     y = y*fontheight(p) - p->var.yoffset;
+    if ((y < 0) && (p->var.vmode & FB_VMODE_YWRAP))
+	y += p->var.yres_virtual;	/* in the wrapped part */
 
     if (y<0)
         y = (y & 0x7FFF) | 0x8000;
     else
 	y = (y & 0x7FFF);
 
-    if (fb->cursor.x == x && fb->cursor.y == y && (mode == CM_ERASE) == !fb->cursor.enable)
+    if (fb->cursor.x == x && fb->cursor.y == y && (mode == CM_ERASE) == !fb->cursor.enable) {
+	ct48fb_own_put();
 	return;
+    }
 
     fb->cursor.enable = 0;
     fb->cursor.x = x;
     fb->cursor.y = y;
 
-    ctBLTWAIT();	/* need to wait... */
+    ct48fb_blt_wait();	/* need to wait... */
 
     /* set cursor position */
-    outl((y<<16)+x, DR0B);
+    write_dr(DR0B, (y<<16)+x);
 
     switch (mode) {
 	case CM_ERASE:
 	    /* turn off cursor */
-	    outl(0x00000020, DR08);
+	    write_dr(DR08, 0x00000020);
 	    break;
 	case CM_DRAW:
 	case CM_MOVE:
 	    /* turn on cursor */
 	    if (noblink) {
-		outl(0x00000021, DR08);
+		write_dr(DR08, 0x00000021);
 	    } else {
-		outl(0x00008021, DR08);
+		write_dr(DR08, 0x00008021);
 	    }
 	    fb->cursor.enable = 1;
 	    break;
     }
+    ct48fb_own_put();
 }
 
 static int ct48fb_acc_set_font(struct display* p, int w, int h)
 {
     struct ct48fb_info *fb = (struct ct48fb_info *)p->fb_info;
 
+    if (!ct48fb_own_try(CT48_OWN_TEXT))
+	return 1;			/* cursor hook catches up with the size later */
     fb->cursor.w = fontwidth(p);
     fb->cursor.h = fontheight(p);
+    fb->glyphs.font = NULL;
 
     ct48fb_set_cursor_shape(fb);
+    ct48fb_own_put();
 
     return 1;
 }
 
-static void ct48fb_set_cursor_shape(struct ct48fb_info *p)
+/* the slots lost what they held (VRAM reset, a program had offscreen VRAM) */
+static void ct48fb_cursor_forget(struct ct48fb_info *p)
 {
+    int n;
+
+    for (n = 0; n < CT48_CURSOR_SLOTS; n++)
+	p->cslot[n].used = 0;
+}
+
+/*
+ * Show image img. Shapes in use stay in the CT48_CURSOR_SLOTS slots from
+ * cursor_base on: one that is still there is a DR0C write away, else it
+ * goes into the least recently used slot. Caller owns the engine.
+ */
+static void ct48fb_cursor_image(struct ct48fb_info *p, const u32 *img)
+{
+    struct ct48fb_cslot *s, *lru = &p->cslot[0];
     u_char *dest;
+    int i, n;
+
+    for (n = 0; n < CT48_CURSOR_SLOTS; n++) {
+	s = &p->cslot[n];
+	if (s->used && !memcmp(s->image, img, sizeof(s->image)))
+	    break;
+	if (s->used < lru->used)
+	    lru = s;
+    }
+    if (n == CT48_CURSOR_SLOTS) {
+	s = lru;
+	n = s - p->cslot;
+	dest = (u_char*)(p->fbmem_virt + p->cursor_base + n * CT48_CURSOR_SIZE);
+
+	ct48fb_blt_sync();	/* need to wait... caller owns the engine */
+
+	for (i=0;i<64;i++)
+	    fb_writel(img[i], dest+4*i);
+	memcpy(s->image, img, sizeof(s->image));
+	p->cslot_loads++;
+    }
+    s->used = ++p->cslot_clock;
+    if (n != p->cslot_cur) {
+	ct48fb_blt_wait();		/* need to wait... */
+	write_dr(DR0C, p->cursor_base + n * CT48_CURSOR_SIZE);
+	p->cslot_cur = n;
+	p->cslot_switches++;
+    }
+}
+
+static void ct48fb_set_cursor_shape(struct ct48fb_info *p)
+{
+    u32 img[64], *dest = img;
     int w,h;
     int i;
 
+    if (ct48fb_cursor_user(p)) {
+	/* a program's pointer, CHIPS_cursorinit() may just have hidden it */
+	ct48fb_cursor_image(p, p->cursor.image);
+	write_dr(DR09, p->cursor.color);
+	write_dr(DR0B, p->cursor.pos);
+	write_dr(DR08, p->cursor.on ? 0x00000021 : 0x00000020);
+	return;
+    }
+
     w = p->cursor.w;
     h = p->cursor.h;
 
@@ -1634,34 +3883,575 @@ static void ct48fb_set_cursor_shape(struct ct48fb_info *p)
     if (h>32)
 	h=32;
 
-    dest = (u_char*)(p->fbmem_virt+p->currentmode.cursor_base);
-
-    ctBLTWAIT();	/* need to wait... */
-
     for (i=0;i<h;i++) {
       switch(w) {	/* XXX: this is probably endianess broken */
         case 8:      /* XXAAXXAA - 0-15 */
-    	    fb_writel(0x00ffffff,dest);
+	    *dest = 0x00ffffff;
 	    break;
 	case 12:
-	    fb_writel(0xf0ffffff,dest);
+	    *dest = 0xf0ffffff;
 	    break;
 	case 14:
-	    fb_writel(0xfcffffff,dest);
+	    *dest = 0xfcffffff;
 	    break;
 	case 16:
-	    fb_writel(0xffffffff,dest);
+	    *dest = 0xffffffff;
 	    break;
 	default:
-	    fb_writel(0x00ff01ff,dest);
+	    *dest = 0x00ff01ff;
 	}
-      dest+=4;
-      fb_writel(0x00ff00ff,dest); dest+=4;
+      dest++;
+      *dest++ = 0x00ff00ff;
     }
     for (;i<32;i++) {
-        fb_writel(0x00ff00ff,dest); dest+=4;
-	fb_writel(0x00ff00ff,dest); dest+=4;
+	*dest++ = 0x00ff00ff;
+	*dest++ = 0x00ff00ff;
+    }
+    ct48fb_cursor_image(p, img);
+}
+
+/* ------------------- userspace hardware cursor ------------------------- */
+
+/* DR0B takes sign and magnitude, a pointer can hang off the top left */
+static inline u_int ct48fb_cursor_coord(int v)
+{
+    return (v < 0) ? ((-v & 0x7fff) | 0x8000) : (v & 0x7fff);
+}
+
+/* 0xRRGGBB to the 5/6/5 DR09 has for either colour */
+static inline u_int ct48fb_cursor_rgb(u32 c)
+{
+    return ((c >> 8) & 0xf800) | ((c >> 5) & 0x07e0) | ((c >> 3) & 0x001f);
+}
+
+/* the console's text cursor again, from scratch at its next blink */
+static void ct48fb_cursor_console(struct ct48fb_info *p)
+{
+    p->cursor.enable = 0;
+    p->cursor.w = 0;			/* its shape */
+    p->cursor.x = -1;			/* ...and position */
+    ct48fb_blt_wait();			/* need to wait... */
+    write_dr(DR08, 0x00000020);
+    write_dr(DR09, p->cursor.concolor);	/* ...and colours */
+}
+
+/* not while the engine is leased, the end of the lease catches up */
+static void ct48fb_cursor_release(void)
+{
+    if (ct48fb_cursor_user(&fb_info)) {
+	if (fb_info.own.lease)
+	    fb_info.deferred |= CT48_DEFER_CURSOR;
+	else
+	    ct48fb_cursor_console(&fb_info);
+    }
+    fb_info.cursor.user = NULL;		/* another console has the text cursor already */
+}
+
+/* the pointer is only on the console it was taken on, elsewhere it is kept */
+static int ct48fb_ioctl_cursor(struct ct48_cursor *arg, struct file *file)
+{
+    struct ct48fb_cursor *c = &fb_info.cursor;
+    struct ct48_cursor cur;
+    u_int m, im, andm, xorm;
+    int i, shown, err = 0;
+
+    if (nohwcursor)
+	return -ENODEV;
+    if (copy_from_user(&cur, arg, sizeof(cur)))
+	return -EFAULT;
+    if ((cur.set & CT48_CUR_HOT) && ((cur.hot_x > 31) || (cur.hot_y > 31)))
+	return -EINVAL;
+    if ((cur.set & CT48_CUR_IMAGE) && (cur.rop != CT48_ROP_COPY) && (cur.rop != CT48_ROP_XOR))
+	return -EINVAL;
+
+    ct48fb_own_get(CT48_OWN_CURSOR);
+    if (c->user && (c->user != file)) {
+	err = -EBUSY;
+	goto out;
+    }
+    if (cur.set & CT48_CUR_RELEASE) {
+	if (c->user)
+	    ct48fb_cursor_release();
+	goto out;
+    }
+    /*
+     * On another console only remembered, switching back shows it. While
+     * the engine is leased neither, the end of the lease shows it.
+     */
+    shown = (c->user ? (c->con == fb_info.con) : 1) && !fb_info.own.lease;
+    if (shown)
+	ct48fb_blt_wait();		/* need to wait, as for the text cursor */
+    if (!c->user) {
+	/* taken from the console: hidden, transparent, white on black */
+	if (shown)
+	    read_dr(DR09, c->concolor);
+	c->user = file;
+	c->pid = current->pid;
+	c->con = fb_info.con;
+	c->on = 0;
+	c->px = c->py = c->hot_x = c->hot_y = 0;
+	c->pos = 0;
+	c->color = ct48fb_cursor_rgb(0xffffff) << 16;
+	for (i = 0; i < 64; i++)
+	    c->image[i] = 0x00ff00ff;
+	if (shown)
+	    ct48fb_set_cursor_shape(&fb_info);
+    }
+
+    if (cur.set & CT48_CUR_HOT) {
+	c->hot_x = cur.hot_x;
+	c->hot_y = cur.hot_y;
+    }
+    if (cur.set & CT48_CUR_IMAGE) {
+	/* per line AND, XOR for pixels 0-7, then 8-15... AND 1 XOR 0 is transparent */
+	for (i = 0; i < 64; i++) {
+	    m = cur.mask[2 * i] | (cur.mask[2 * i + 1] << 16);
+	    im = cur.image[2 * i] | (cur.image[2 * i + 1] << 16);
+	    xorm = m & im;
+	    andm = (cur.rop == CT48_ROP_XOR) ? 0x00ff00ff : (~m & 0x00ff00ff);
+	    c->image[i] = andm | (xorm << 8);
+	}
+	if (shown)
+	    ct48fb_cursor_image(&fb_info, c->image);
+    }
+    if (cur.set & CT48_CUR_COLOR) {
+	c->color = (ct48fb_cursor_rgb(cur.fg) << 16) | ct48fb_cursor_rgb(cur.bg);
+	if (shown)
+	    write_dr(DR09, c->color);
+    }
+    if (cur.set & (CT48_CUR_POS | CT48_CUR_HOT)) {
+	if (cur.set & CT48_CUR_POS) {
+	    c->px = cur.x;
+	    c->py = cur.y;
+	}
+	c->pos = (ct48fb_cursor_coord(c->py - c->hot_y) << 16) + ct48fb_cursor_coord(c->px - c->hot_x);
+	if (shown)
+	    write_dr(DR0B, c->pos);
+    }
+    if ((cur.set & CT48_CUR_SHOW) && (c->on != !!cur.enable)) {
+	c->on = !!cur.enable;
+	if (shown)
+	    write_dr(DR08, c->on ? 0x00000021 : 0x00000020);
+    }
+out:
+    ct48fb_own_put();
+    return err;
+}
+
+/* ------------------- userspace BitBLT interface ------------------------- */
+
+#define CT48_MONO_BUF	4096		/* bitmap bytes streamed per blit */
+
+static inline u_int ct48fb_blit_color(u_int c)
+{
+    return (fb_info.currentmode.bpp == 8) ? ctCOLOR8(c) : ctCOLOR16(c);
+}
+
+/* a w x h rectangle at x,y on the screen or in the caller's offscreen blocks */
+static int ct48fb_blit_area(struct file *file, u_int x, u_int y, u_int w, u_int h)
+{
+    struct ct48fb_par *m = &fb_info.currentmode;
+    int bytespp = m->bpp >> 3;
+    u_int xmax = m->linelength / bytespp;
+    u_int ymax = fb_info.vram.end / m->linelength;
+
+    if ((x + w > xmax) || (y + h > ymax))
+	return 0;
+    return ct48fb_vram_mine(file, y * m->linelength + x * bytespp,
+			    (y + h - 1) * m->linelength + (x + w) * bytespp);
+}
+
+/* caller owns the engine, the blocks can't go away meanwhile */
+static int ct48fb_blit_check(const struct ct48_blit *b, struct file *file)
+{
+    int bytespp = fb_info.currentmode.bpp >> 3;
+
+    if (!b->w || !b->h || (b->rop > CT48_ROP_INVERT))
+	return -EINVAL;
+    if ((b->w * bytespp > 0xfff) || (b->h > 0xfff))
+	return -EINVAL;
+    if (!ct48fb_blit_area(file, b->dx, b->dy, b->w, b->h))
+	return -EINVAL;
+    switch (b->op) {
+	case CT48_OP_FILL:
+	case CT48_OP_PATTERN:
+	    return 0;
+	case CT48_OP_COPY:
+	    if (!ct48fb_blit_area(file, b->sx, b->sy, b->w, b->h))
+		return -EINVAL;
+	    return 0;
+	case CT48_OP_MONO:
+	    if (!b->data || (b->pitch < (b->w + 7) / 8) || ((((b->w + 7) / 8 + 3) & ~3) > CT48_MONO_BUF))
+		return -EINVAL;
+	    return 0;
+    }
+    return -EINVAL;
+}
+
+/* bitmap from userspace, expanded in strips that fit into buf, caller owns the engine */
+static int ct48fb_blit_mono(const struct ct48_blit *b, struct ct48fb_blt_cmd *cmd, u32 *buf)
+{
+    struct ct48fb_par *m = &fb_info.currentmode;
+    u_int bytes = (b->w + 7) / 8;
+    u_int stride = (bytes + 3) & ~3;		/* every line starts a new dword */
+    u_int rows, y, n, i;
+    u32 *dest;
+
+    rows = CT48_MONO_BUF / stride;
+    for (y = 0; y < b->h; y += rows) {
+	n = (b->h - y < rows) ? b->h - y : rows;
+	memset(buf, 0, n * stride);
+	for (i = 0; i < n; i++)
+	    if (copy_from_user((u_char *)buf + i * stride, b->data + (y + i) * b->pitch, bytes))
+		return -EFAULT;
+
+	cmd->dst = (b->dy + y) * m->linelength + b->dx * (m->bpp >> 3);
+	cmd->hw = ctHEIGHTWIDTH(n, b->w * (m->bpp >> 3));
+	ct48fb_blt_sync();
+	ct48fb_blt_start(cmd);
+	dest = (u32 *)fb_info.fbmem_virt;
+	for (i = 0; i < n * stride / 4; i++)
+	    fb_writel(buf[i], dest++);
+    }
+    return 0;
+}
+
+/* one op that passed ct48fb_blit_check(), caller owns the engine */
+static int ct48fb_blit_one(const struct ct48_blit *b, u32 *buf)
+{
+    struct ct48fb_par *m = &fb_info.currentmode;
+    struct ct48fb_blt_cmd cmd;
+    int bytespp = m->bpp >> 3;
+    u_int dir = ctTOP2BOTTOM | ctLEFT2RIGHT;
+    u_int transp = (b->flags & CT48_BLIT_TRANSPARENT) ? ctBGTRANSPARENT : 0;
+    int i;
+
+    cmd.dst = b->dy * m->linelength + b->dx * bytespp;
+    cmd.pitch = ctPITCH(0, m->linelength);
+    cmd.hw = ctHEIGHTWIDTH(b->h, b->w * bytespp);
+    cmd.fg = ct48fb_blit_color(b->fg);
+    cmd.bg = ct48fb_blit_color(b->bg);
+
+    switch (b->op) {
+	case CT48_OP_FILL:
+	    cmd.flags = CT48_BLT_COLOR;
+	    cmd.bg = cmd.fg;
+	    cmd.rop = ctAluConv2[b->rop] | dir | ctPATSOLID | ctPATMONO;
+	    break;
+	case CT48_OP_COPY:
+	    ct48fb_blt_copycmd(&cmd, b->sx, b->sy, b->dx, b->dy, b->w, b->h, m->linelength, bytespp);
+	    cmd.rop = (cmd.rop & ~0xff) | ctAluConv[b->rop];
+	    break;
+	case CT48_OP_PATTERN:
+	    cmd.flags = CT48_BLT_COLOR | CT48_BLT_PAT;
+	    cmd.pat = fb_info.pattern_base;
+	    /* x alignment comes from the destination, y has to be seeded */
+	    cmd.rop = ctAluConv2[b->rop] | dir | ctPATMONO | transp | ((b->dy & 7) << 16);
+	    if (!fb_info.pattern_ok || memcmp(fb_info.pattern, b->pattern, 8)) {
+		ct48fb_blt_sync();		/* queued blits may still use the old one */
+		for (i = 0; i < 8; i++)
+		    fb_writeb(b->pattern[i], fb_info.fbmem_virt + cmd.pat + i);
+		memcpy(fb_info.pattern, b->pattern, 8);
+		fb_info.pattern_ok = 1;
+	    }
+	    break;
+	case CT48_OP_MONO:
+	    cmd.flags = CT48_BLT_SRC | CT48_BLT_COLOR;
+	    cmd.src = 0;
+	    cmd.rop = ctAluConv[b->rop] | dir | ctSRCMONO | ctSRCSYSTEM | transp;
+	    return ct48fb_blit_mono(b, &cmd, buf);
+    }
+
+    ct48fb_blt_queue(&cmd);
+    return 0;
+}
+
+static int ct48fb_ioctl_blit(struct ct48_batch *arg, struct file *file)
+{
+    struct ct48_batch batch;
+    struct ct48_blit *ops;
+    u32 *buf = NULL;
+    u_int i;
+    int err = 0;
+
+    if (copy_from_user(&batch, arg, sizeof(batch)))
+	return -EFAULT;
+    if (batch.count > CT48_BATCH_MAX)
+	return -EINVAL;
+    ops = kmalloc(batch.count * sizeof(*ops) + 1, GFP_KERNEL);
+    if (!ops)
+	return -ENOMEM;
+    if (copy_from_user(ops, batch.ops, batch.count * sizeof(*ops))) {
+	kfree(ops);
+	return -EFAULT;
     }
+
+    for (i = 0; i < batch.count; i++) {
+	if (ops[i].op == CT48_OP_MONO) {
+	    buf = kmalloc(CT48_MONO_BUF, GFP_KERNEL);
+	    if (!buf) {
+		err = -ENOMEM;
+		goto out;
+	    }
+	    break;
+	}
+    }
+
+    /*
+     * Checked and queued without letting go of the engine: a VRAM_FREE, a
+     * close or a mode change can't move the blocks in between. The whole
+     * batch is refused rather than half of it drawn, only a bitmap that
+     * can't be read stops it midway.
+     */
+    if (!ct48fb_own_try(CT48_OWN_USER)) {
+	err = -EBUSY;
+	goto out;
+    }
+    for (i = 0; i < batch.count; i++) {
+	err = ct48fb_blit_check(&ops[i], file);
+	if (err)
+	    break;
+    }
+    for (i = 0; !err && (i < batch.count); i++)
+	err = ct48fb_blit_one(&ops[i], buf);
+    batch.fence = ct48fb_blt_fence();
+    ct48fb_own_put();
+
+    if (copy_to_user(&arg->fence, &batch.fence, sizeof(batch.fence)))
+	err = -EFAULT;
+out:
+    if (buf)
+	kfree(buf);
+    kfree(ops);
+    return err;
+}
+
+static int ct48fb_ioctl_vram(u_int cmd, struct ct48_vram *arg, struct file *file)
+{
+    struct ct48_vram req;
+    u_long align;
+    int err = 0;
+
+    /* whoever may draw may have offscreen memory */
+    if (!(file->f_mode & FMODE_WRITE))
+	return -EPERM;
+    if (copy_from_user(&req, arg, sizeof(req)))
+	return -EFAULT;
+
+    ct48fb_own_get(CT48_OWN_DRIVER);
+    if (cmd == CT48FB_VRAM_ALLOC) {
+	align = req.align ? req.align : 4;
+	if (align & (align - 1)) {
+	    err = -EINVAL;
+	} else if (ct48fb_vram_count(file) >= CT48_VRAM_USER) {
+	    err = -ENOMEM;
+	} else {
+	    req.offset = ct48fb_vram_alloc(req.size, align, "user", file);
+	    if (req.offset == CT48_VRAM_NONE)
+		err = -ENOMEM;
+	}
+    } else if (!ct48fb_vram_put(req.offset, file)) {
+	err = -EINVAL;
+    }
+    ct48fb_own_put();
+
+    if (!err && (cmd == CT48FB_VRAM_ALLOC) && copy_to_user(&arg->offset, &req.offset, sizeof(req.offset)))
+	err = -EFAULT;
+    return err;
+}
+
+/*
+ * Palette at retrace. Boards don't wire the retrace interrupt, so the
+ * timer looks at the retrace bit once every tick, without waiting, and
+ * loads the queue when it finds the chip in a retrace - or after
+ * CT48_VBL_TRIES ticks anyway. Whoever else waits for a retrace
+ * (FBIO_WAITFORVSYNC, page flips) puts the queue out too.
+ */
+#define CT48_VBL_TRIES		(HZ/10)	/* ticks before loading it regardless */
+
+static void ct48fb_cmap_timer(unsigned long data)
+{
+    struct ct48fb_info *i = (struct ct48fb_info *)data;
+    u_int tmp;
+
+    if (CHIPS_dacfirst > CHIPS_daclast)
+	return;				/* somebody was at a retrace first */
+    read_is1(tmp);
+    if (!(tmp & VGA_IS1_VRETRACE) && (++i->cmap_tries < CT48_VBL_TRIES)) {
+	mod_timer(&i->cmap_timer, jiffies + 1);
+	return;
+    }
+    CHIPS_flushdac();
+}
+
+static int ct48fb_ioctl_putcmap_vbl(struct fb_cmap *arg, int con, struct fb_info *info)
+{
+    struct fb_cmap cmap;
+    unsigned long flags;
+    u16 *buf;
+    u_int n, size;
+
+    if (copy_from_user(&cmap, arg, sizeof(cmap)))
+	return -EFAULT;
+    /* no DAC involved, nothing to tear - or another console's, that is only kept */
+    if ((fb_info.currentmode.bpp != 8) || (con != fb_info.con))
+	return info->fbops->fb_set_cmap(&cmap, 0, con, info);
+    if ((cmap.start > 256) || (cmap.len > 256 - cmap.start))
+	return -EINVAL;
+    if (!cmap.len)
+	return 0;
+
+    size = cmap.len * sizeof(u16);
+    buf = kmalloc(4 * size, GFP_KERNEL);
+    if (!buf)
+	return -ENOMEM;
+    if (copy_from_user(buf, cmap.red, size) ||
+	copy_from_user(buf + cmap.len, cmap.green, size) ||
+	copy_from_user(buf + 2 * cmap.len, cmap.blue, size) ||
+	(cmap.transp && copy_from_user(buf + 3 * cmap.len, cmap.transp, size))) {
+	kfree(buf);
+	return -EFAULT;
+    }
+
+    /* all of it in one go, a retrace doesn't get half of an update */
+    spin_lock_irqsave(&CHIPS_daclock, flags);
+    for (n = 0; n < cmap.len; n++) {
+	palette[cmap.start + n].red = buf[n];
+	palette[cmap.start + n].green = buf[cmap.len + n];
+	palette[cmap.start + n].blue = buf[2 * cmap.len + n];
+	palette[cmap.start + n].transp = cmap.transp ? buf[3 * cmap.len + n] : 0;
+    }
+    if (cmap.start < CHIPS_dacfirst)
+	CHIPS_dacfirst = cmap.start;
+    if (cmap.start + cmap.len - 1 > CHIPS_daclast)
+	CHIPS_daclast = cmap.start + cmap.len - 1;
+    spin_unlock_irqrestore(&CHIPS_daclock, flags);
+    kfree(buf);
+
+    if (!timer_pending(&fb_info.cmap_timer)) {
+	fb_info.cmap_tries = 0;
+	mod_timer(&fb_info.cmap_timer, jiffies + 1);
+    }
+    return 0;
+}
+
+/*
+ * Sleep until fence has passed, the drain timer keeps issuing meanwhile.
+ * The engine is hung when the queue doesn't move for as long as a single
+ * blit may take.
+ */
+static int ct48fb_fence_wait(u32 fence)
+{
+    struct ct48fb_bltq *q = &fb_info.bltq;
+    u_int head = q->head;
+    u_long moved = jiffies;
+    int passed;
+
+    for (;;) {
+	if (!ct48fb_own_try(CT48_OWN_USER))
+	    return -EBUSY;
+	passed = ct48fb_blt_passed(fence);
+	ct48fb_own_put();
+	if (passed)
+	    return 0;
+	if (q->head != head) {
+	    head = q->head;
+	    moved = jiffies;
+	} else if (time_after(jiffies, moved + CT48_BLT_TIMEOUT / (1000000 / HZ)))
+	    return -EIO;
+	if (signal_pending(current))
+	    return -ERESTARTSYS;
+	set_current_state(TASK_INTERRUPTIBLE);
+	schedule_timeout(1);
+    }
+}
+
+static int ct48fb_ioctl_vblank(struct fb_vblank *arg)
+{
+    struct fb_vblank vbl;
+    u_int tmp;
+
+    memset(&vbl, 0, sizeof(vbl));
+    vbl.flags = FB_VBLANK_HAVE_VBLANK | FB_VBLANK_HAVE_HBLANK;
+    read_is1(tmp);
+    if (tmp & VGA_IS1_VRETRACE)
+	vbl.flags |= FB_VBLANK_VBLANKING;
+    else if (tmp & 0x01)			/* display enable off, so horizontal */
+	vbl.flags |= FB_VBLANK_HBLANKING;
+    vbl.count = CHIPS_vblwaits;		/* only the retraces we waited for */
+    if (copy_to_user(arg, &vbl, sizeof(vbl)))
+	return -EFAULT;
+    return 0;
+}
+
+static int ct48fb_ioctl(struct inode *inode, struct file *file, u_int cmd,
+			u_long arg, int con, struct fb_info *info)
+{
+    u32 fence, crtc;
+    int err;
+
+    switch (cmd) {
+	case CT48FB_BLIT:
+	    if (noaccel)
+		return -ENODEV;
+	    return ct48fb_ioctl_blit((struct ct48_batch *)arg, file);
+	case CT48FB_FENCE_POLL:
+	    if (get_user(fence, (u32 *)arg))
+		return -EFAULT;
+	    return put_user(noaccel || ct48fb_blt_passed(fence), (u32 *)arg);
+	case CT48FB_FENCE_WAIT:
+	    if (get_user(fence, (u32 *)arg))
+		return -EFAULT;
+	    if (noaccel)
+		return 0;
+	    return ct48fb_fence_wait(fence);
+	case CT48FB_ENGINE_ACQUIRE:
+	    if (noaccel)
+		return -ENODEV;
+	    return ct48fb_lease_get(file);
+	case CT48FB_ENGINE_RELEASE:
+	    return ct48fb_lease_put(file);
+	case CT48FB_VRAM_ALLOC:
+	case CT48FB_VRAM_FREE:
+	    return ct48fb_ioctl_vram(cmd, (struct ct48_vram *)arg, file);
+	case FBIO_WAITFORVSYNC:
+	    if (get_user(crtc, (u32 *)arg))
+		return -EFAULT;
+	    if (crtc != 0)
+		return -ENODEV;			/* one CRTC only */
+	    err = CHIPS_waitvblank();
+	    CHIPS_flushdac();
+	    return err;
+	case CT48FB_PUTCMAP_VBL:
+	    return ct48fb_ioctl_putcmap_vbl((struct fb_cmap *)arg, con, info);
+	case FBIOGET_VBLANK:
+	    return ct48fb_ioctl_vblank((struct fb_vblank *)arg);
+	case CT48FB_CURSOR:
+	    return ct48fb_ioctl_cursor((struct ct48_cursor *)arg, file);
+    }
+    return -EINVAL;
+}
+
+static int ct48fb_release(struct fb_info *info, int user)
+{
+
+    if (!user)
+	return 0;
+    /*
+     * fb_release() isn't told which file is going away: it is the one whose
+     * last reference was just dropped. Closing the device (or dying) gives a
+     * leased engine back.
+     */
+    if (fb_info.own.lease && !file_count(fb_info.own.lease))
+	ct48fb_lease_put(fb_info.own.lease);
+    /* ...and its offscreen buffers */
+    ct48fb_own_get(CT48_OWN_DRIVER);
+    ct48fb_vram_drop();
+    /* ...and the hardware cursor */
+    if (fb_info.cursor.user && !file_count(fb_info.cursor.user))
+	ct48fb_cursor_release();
+    ct48fb_own_put();
+    return 0;
 }
 
 /* ------------------------------------------------------------------------- */
@@ -1674,13 +4464,21 @@ MODULE_DESCRIPTION("CT65548/45/40 framebuffer driver");
 MODULE_PARM(noaccel,"i");
 MODULE_PARM_DESC(noaccel, "Do not use accelerating engine (1=true, default=0)");
 MODULE_PARM(noaccputc,"i");
-MODULE_PARM_DESC(noaccputc, "Do not use accelerated putc (1=true, default=1)");
+MODULE_PARM_DESC(noaccputc, "Do not use accelerated putc (1=true, default=0)");
 MODULE_PARM(nohwcursor,"i");
 MODULE_PARM_DESC(nohwcursor, "Do not use hardware cursor (1=true, default=0)");
 MODULE_PARM(noblink,"i");
 MODULE_PARM_DESC(noblink, "Do not blink hardware cursor (1=true, default=1)");
 MODULE_PARM(noinverse,"i");
 MODULE_PARM_DESC(noinverse, "Do not inverse the screen (1=true, default=1)");
+MODULE_PARM(nommio,"i");
+MODULE_PARM_DESC(nommio, "Do not use memory mapped DR registers, PCI only (1=true, default=1)");
+MODULE_PARM(noregtrace,"i");
+MODULE_PARM_DESC(noregtrace, "Do not trace register accesses (1=true, default=1)");
+MODULE_PARM(noypan,"i");
+MODULE_PARM_DESC(noypan, "Do not scroll console by panning (1=true, default=0)");
+MODULE_PARM(noywrap,"i");
+MODULE_PARM_DESC(noywrap, "Do not wrap console around using line compare (1=true, default=1)");
 MODULE_PARM(mode,"s");
 MODULE_PARM_DESC(mode, "Selected primary video mode");
 MODULE_DEVICE_TABLE(pci,ct_devices);
@@ -0,0 +1,191 @@
+
+/*
+ *  ct48fb.h - userspace interface of the Chips&Technologies 65548/45/40
+ *  framebuffer driver
+ *
+ *	Copyright (C) 2003,2004 Maciej Witkowiak <ytm@elysium.pl>
+ *
+ *  This file is subject to the terms and conditions of the GNU General Public
+ *  License. See the file COPYING in the main directory of this archive for
+ *  more details.
+ */
+
+#ifndef __CT48FB_H__
+#define __CT48FB_H__
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#include <linux/fb.h>
+
+/*
+    BitBLT batches
+
+    CT48FB_BLIT takes an array of operations, queues them all on the
+    BitBLT engine and returns without waiting. The fence it hands back can
+    be checked with CT48FB_FENCE_POLL or slept on with CT48FB_FENCE_WAIT
+    before touching the affected area with the CPU. CT48FB_FENCE_WAIT
+    sleeps a timer tick between checks, fails with EIO when the engine
+    hangs and with EBUSY while the engine is leased.
+
+    Coordinates are in pixels of the virtual screen, colours are pixel
+    values (palette index in 8bpp, RGB565 in 16bpp). Rectangles below
+    the virtual screen have to lie inside one of the caller's offscreen
+    blocks, otherwise the batch fails with EINVAL and none of it is drawn.
+*/
+
+/* operations */
+#define CT48_OP_FILL		1	/* solid rectangle in fg */
+#define CT48_OP_COPY		2	/* screen to screen, areas may overlap */
+#define CT48_OP_MONO		3	/* expand 1bpp bitmap from 'data' to fg/bg */
+#define CT48_OP_PATTERN		4	/* 8x8 1bpp 'pattern' repeated over the rectangle */
+
+/* raster operations, applied to source/pattern and destination */
+#define CT48_ROP_COPY		0
+#define CT48_ROP_OR		1
+#define CT48_ROP_AND		2
+#define CT48_ROP_XOR		3
+#define CT48_ROP_INVERT		4	/* dest = ~dest, source ignored */
+
+/* flags */
+#define CT48_BLIT_TRANSPARENT	0x0001	/* MONO/PATTERN: 0 bits leave dest alone */
+
+struct ct48_blit {
+	__u16 op;			/* CT48_OP_* */
+	__u16 rop;			/* CT48_ROP_* */
+	__u16 flags;			/* CT48_BLIT_* */
+	__u16 pitch;			/* MONO: bytes per bitmap line */
+	__u16 sx, sy;			/* COPY: source */
+	__u16 dx, dy;			/* destination */
+	__u16 w, h;
+	__u32 fg, bg;
+	__u8 pattern[8];		/* PATTERN: top line first, bit 7 leftmost */
+	const __u8 *data;		/* MONO: bitmap, bit 7 of byte 0 leftmost */
+};
+
+#define CT48_BATCH_MAX		256	/* operations per CT48FB_BLIT call */
+
+struct ct48_batch {
+	__u32 count;
+	const struct ct48_blit *ops;
+	__u32 fence;			/* out: passed once all ops are done */
+};
+
+#define CT48FB_BLIT		_IOWR('F', 0xC0, struct ct48_batch)
+#define CT48FB_FENCE_POLL	_IOWR('F', 0xC1, __u32)	/* in: fence, out: 1 if passed */
+#define CT48FB_FENCE_WAIT	_IOW('F', 0xC2, __u32)
+
+/*
+    Engine lease
+
+    A program that programs the BitBLT registers itself takes the engine
+    with CT48FB_ENGINE_ACQUIRE (needs iopl(3) for the DR ports as well).
+    The lease belongs to the open file it was taken on. Until
+    CT48FB_ENGINE_RELEASE on that file, or until the file is closed, the
+    kernel doesn't touch the engine, the CRTC nor offscreen VRAM: console
+    drawing is dropped (and counted in /proc/driver/ct48fb), mode changes
+    and what CT48FB_CURSOR or a console switch would show of the hardware
+    cursor wait for the end of the lease, panning and CT48FB_BLIT fail with
+    EBUSY. Put the console into KD_GRAPHICS meanwhile, switching back
+    repaints it.
+*/
+
+#define CT48FB_ENGINE_ACQUIRE	_IO('F', 0xC3)
+#define CT48FB_ENGINE_RELEASE	_IO('F', 0xC4)
+
+/*
+    Offscreen VRAM
+
+    CT48FB_VRAM_ALLOC hands out a block of the memory after the virtual
+    screen; offset counts from the start of the framebuffer, so the block
+    can be reached through mmap and as y >= yres_virtual in blits.
+    The device has to be open for writing and one open file gets up to 8
+    blocks. Blocks are freed with CT48FB_VRAM_FREE or when that file is
+    closed, and are lost when the depth or the virtual screen size changes.
+*/
+
+struct ct48_vram {
+	__u32 size;			/* bytes */
+	__u32 align;			/* power of 2, 0 = 4 */
+	__u32 offset;			/* out for ALLOC, in for FREE */
+};
+
+#define CT48FB_VRAM_ALLOC	_IOWR('F', 0xC5, struct ct48_vram)
+#define CT48FB_VRAM_FREE	_IOW('F', 0xC6, struct ct48_vram)
+
+/*
+    Vertical retrace
+
+    FBIO_WAITFORVSYNC (argument: CRTC number, always 0) returns at the
+    start of the next vertical retrace. Panning with FB_ACTIVATE_VBL in
+    var.activate waits for the blits, sets the new start and returns at
+    the retrace that shows it, for flicker free page flipping within
+    yres_virtual. Both poll the retrace bit: the caller spins for up to a
+    frame (40 ms with the display off), giving the CPU up only to tasks
+    that need it.
+*/
+
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC	_IOW('F', 0x20, __u32)
+#endif
+
+/*
+    CT48FB_PUTCMAP_VBL takes a colormap like FBIOPUTCMAP, but only queues
+    it and returns at once. The entries go to the DAC in a later retrace
+    - the next one FBIO_WAITFORVSYNC or a FB_ACTIVATE_VBL pan waits for,
+    else one the timer tick happens to land in - so palette animation
+    doesn't tear. After a tenth of a second without either they are
+    loaded anyway. What is queued before that goes out together, the
+    last colour of an entry wins. In 16bpp, and for a console that isn't
+    on the screen, it is plain FBIOPUTCMAP.
+*/
+
+#define CT48FB_PUTCMAP_VBL	_IOW('F', 0xC7, struct fb_cmap)
+
+/*
+    Hardware cursor
+
+    CT48FB_CURSOR hands the 32x32 hardware cursor to a program, much like
+    FBIO_CURSOR of later kernels. 'set' says which fields to take; moving
+    the pointer with CT48_CUR_POS alone is a single register write once
+    the BitBLT engine is idle. The first call takes the cursor away from
+    the console (it starts hidden and transparent), CT48_CUR_RELEASE or
+    closing the device gives it back. It belongs to the open file and to
+    the console on the screen then; on other consoles the text cursor is
+    back and calls only change what is shown on returning. Fails with
+    ENODEV when there is no hardware cursor and with EBUSY while another
+    open file has it.
+
+    mask and image are 32 lines of 4 bytes, bit 7 of byte 0 leftmost.
+    Where mask is 0 the screen shows through. Where it is 1 the pixel is
+    fg if image is 1 and bg if not (CT48_ROP_COPY), or the screen is
+    inverted where image is 1 (CT48_ROP_XOR). Colours are 0xRRGGBB, shown
+    with 5/6/5 bits whatever the depth. x, y is where the hotspot goes on
+    the visible screen, the image may hang off any edge.
+    The driver keeps recently used images in video memory, setting one of
+    those again is about as cheap as a move.
+*/
+
+#define CT48_CUR_SHOW		0x0001	/* enable */
+#define CT48_CUR_POS		0x0002	/* x, y */
+#define CT48_CUR_HOT		0x0004	/* hot_x, hot_y */
+#define CT48_CUR_IMAGE		0x0008	/* mask, image, rop */
+#define CT48_CUR_COLOR		0x0010	/* fg, bg */
+#define CT48_CUR_RELEASE	0x0080	/* back to the console, the rest is ignored */
+
+#define CT48_CURSOR_BYTES	128	/* of mask or image */
+
+struct ct48_cursor {
+	__u16 set;			/* CT48_CUR_* */
+	__u16 enable;
+	__s16 x, y;
+	__u16 hot_x, hot_y;		/* 0-31 */
+	__u16 rop;			/* CT48_ROP_COPY or CT48_ROP_XOR */
+	__u16 reserved;
+	__u32 fg, bg;
+	__u8 mask[CT48_CURSOR_BYTES];
+	__u8 image[CT48_CURSOR_BYTES];
+};
+
+#define CT48FB_CURSOR		_IOW('F', 0xC8, struct ct48_cursor)
+
+#endif /* __CT48FB_H__ */